@@ -0,0 +1,57 @@
+// keywords.h - generated by mkkeywords.c, do not edit
+
+#define KEYWORD_TABLE_SIZE 32
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 9
+
+// length must be at least KEYWORD_MIN_LENGTH
+unsigned int keywordHash(const char *text, int length)
+{
+    return ((unsigned char)text[0] * 1 + (unsigned char)text[1] * 9 + length) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+struct
+{
+    char *text;
+    int length;
+    int type;
+} keywordTable[KEYWORD_TABLE_SIZE] = {
+    [0] = {"then", 4, thensym},
+    [1] = {"if", 2, ifsym},
+    [2] = {"var", 3, varsym},
+    [3] = {"read", 4, readsym},
+    [4] = {"while", 5, whilesym},
+    [6] = {"end", 3, endsym},
+    [13] = {"do", 2, dosym},
+    [15] = {"const", 5, constsym},
+    [16] = {"call", 4, callsym},
+    [20] = {"begin", 5, beginsym},
+    [21] = {"else", 4, elsesym},
+    [22] = {"odd", 3, oddsym},
+    [25] = {"fi", 2, fisym},
+    [27] = {"procedure", 9, procsym},
+    [30] = {"write", 5, writesym},
+};
+
+// one character symbols by character, two character ones by their first
+const unsigned char oneCharSymbols[256] = {
+    ['+'] = plussym,
+    ['-'] = minussym,
+    ['*'] = multsym,
+    ['/'] = slashsym,
+    ['('] = lparentsym,
+    [')'] = rparentsym,
+    ['='] = eqsym,
+    [','] = commasym,
+    ['.'] = periodsym,
+    ['<'] = lessym,
+    ['>'] = gtrsym,
+    [';'] = semicolonsym,
+};
+
+const unsigned char twoCharSymbols[256] = {
+    [':'] = becomessym,
+    ['<'] = leqsym,
+    ['>'] = geqsym,
+    ['!'] = neqsym,
+};
@@ -1,387 +1,512 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <time.h>
 
-typedef enum
+#include "lexer.h"
+
+double now()
 {
-    skipsym = 1,
-    identsym,
-    numbersym,
-    plussym,
-    minussym,
-    multsym,
-    slashsym,
-    fisym,
-    eqsym,
-    neqsym,
-    lessym,
-    leqsym,
-    gtrsym,
-    geqsym,
-    lparentsym,
-    rparentsym,
-    commasym,
-    semicolonsym,
-    periodsym,
-    becomessym,
-    beginsym,
-    endsym,
-    ifsym,
-    thensym,
-    whilesym,
-    dosym,
-    callsym,
-    constsym,
-    varsym,
-    procsym,
-    writesym,
-    readsym,
-    elsesym
-} token_type;
-
-char *reserved_words[] = {
-    "const",
-    "var",
-    "procedure",
-    "call",
-    "begin",
-    "end",
-    "if",
-    "fi",
-    "then",
-    "else",
-    "while",
-    "do",
-    "read",
-    "write"};
-
-char *symbols[] = {
-    "+",
-    "-",
-    "*",
-    "/",
-    "(",
-    ")",
-    ":=",
-    "<=",
-    ">=",
-    ",",
-    ".",
-    "<",
-    ">",
-    ";",
-    ":",
-    "!=",
-    "="};
-
-char source[5012];
-int tokenCount = 0;
-
-typedef enum
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// build a pl0 program of at least size bytes out of a repeating procedure
+char *generateProgram(int size, int *length)
 {
-    KEYWORD,
-    IDENTIFIER,
-    NUMBER,
-    OPERATOR,
-    SYMBOL
-} TokenType;
-
-typedef struct
+    char *text = malloc(size + 512);
+    int n = 0, k = 0;
+
+    n += sprintf(text + n, "var x, y, z;\n");
+    while (n < size)
+    {
+        n += sprintf(text + n,
+                     "procedure p%d; /* generated procedure %d */\n"
+                     "   var a%d, b%d, counter%d;\n"
+                     "begin\n"
+                     "   a%d := x; b%d := %d; z := 0;\n"
+                     "   while b%d > 0 do\n"
+                     "   begin\n"
+                     "      if a%d <= 1 then z := z + a%d fi;\n"
+                     "      a%d := 2 * (a%d - 1); b%d := b%d / 2;\n"
+                     "      if counter%d != y then write counter%d fi\n"
+                     "   end\n"
+                     "end;\n",
+                     k, k, k, k, k, k, k, k % 1000, k, k, k, k, k, k, k, k, k);
+        k++;
+    }
+    n += sprintf(text + n, "begin x := 7; y := 85; call p0 end.\n");
+    *length = n;
+    return text;
+}
+
+// text made mostly of long comments, or mostly of long identifiers
+char *generateRuns(int size, int *length, int comments)
 {
-    TokenType type;
-    char value[100];
-} Token;
+    char *text = malloc(size + 512);
+    int n = 0, k = 0;
 
-Token tokens[1024];
+    while (n < size)
+    {
+        if (comments)
+            n += sprintf(text + n,
+                         "/* step %d: the value of x is doubled and then halved again, which keeps it\n"
+                         "   unchanged but keeps the interpreter busy for a while longer. comments\n"
+                         "   like this one document every statement of the generated program and\n"
+                         "   make up most of its text, as they do in heavily annotated sources */\n"
+                         "x := x * 2 / 2;\n",
+                         k);
+        else
+            n += sprintf(text + n, "accumulator%d := accumulator%d + multiplicand%d * multiplicand%d;\n", k % 97, k % 89, k % 83, k % 79);
+        k++;
+    }
+    *length = n;
+    return text;
+}
 
-int is_letter(char c)
+// best of five runs, in seconds
+double timeTokenize(const char *text, int length)
 {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    double best = 1e9;
+    for (int run = 0; run < 5; run++)
+    {
+        tokenCount = 0;
+        double start = now();
+        tokenize(text, length);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return best;
 }
 
-int isSymbol(char c)
+// reserved word lookups per second over a random mix of keywords and identifiers
+void benchKeywords()
 {
-    return !isalnum((unsigned char)c) && !isspace((unsigned char)c) && c != '_' && c != '\0' && c != '\n' && c != '\r' && c != '\t';
+    const char *words[] = {"begin", "end", "if", "then", "while", "do", "x", "counter", "procedure", "fi",
+                           "write", "accumulator", "var", "odd", "b", "read", "call", "const", "else", "y"};
+    int count = sizeof(words) / sizeof(words[0]);
+    const char *mix[4096];
+    int lengths[4096];
+    srand(1);
+    for (int i = 0; i < 4096; i++)
+    {
+        mix[i] = words[rand() % count];
+        lengths[i] = strlen(mix[i]);
+    }
+
+    int rounds = 10000, found = 0;
+    double start = now();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < 4096; i++)
+            found += getKeywordValue(mix[i], lengths[i]) != -1;
+    double elapsed = now() - start;
+    printf("\nKeyword lookup: %.1f Mlookups/s, %.1f%% keywords\n", rounds * 4096.0 / 1e6 / elapsed, found * 100.0 / rounds / 4096);
 }
 
-int is_digit(char c)
+// parallel against serial lexing of a generated program, checking that
+// both produce the same token list
+void benchParallel(int megabytes)
 {
-    return c >= '0' && c <= '9';
+    int length;
+    char *text = generateProgram(megabytes * 1024 * 1024, &length);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    tokenCount = 0;
+    tokenize(text, length);
+    int serialCount = tokenCount;
+    Token *serial = malloc((serialCount + 1) * sizeof(Token));
+    memcpy(serial, tokens, (serialCount + 1) * sizeof(Token));
+    double serialTime = timeTokenize(text, length);
+
+    printf("\nParallel lexing: %.1f MB, %ld cores online\n", length / 1048576.0, cores);
+    printf("  serial    %.3f s  %.1f MB/s\n", serialTime, length / 1048576.0 / serialTime);
+    for (int threads = 2; threads <= 16; threads *= 2)
+    {
+        double best = 1e9;
+        for (int run = 0; run < 5; run++)
+        {
+            tokenCount = 0;
+            double start = now();
+            tokenizeParallel(text, length, threads);
+            double elapsed = now() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+        int same = tokenCount == serialCount && memcmp(tokens, serial, (serialCount + 1) * sizeof(Token)) == 0;
+        printf("  %2d threads %.3f s  %.1f MB/s  %.2fx  %s\n", threads, best, length / 1048576.0 / best, serialTime / best,
+               same ? "identical" : "MISMATCH");
+    }
+    free(serial);
+    free(text);
 }
 
-int starts_with(char *str, char *prefix)
+// forget every interned name, so the next lexing hands out ids from 1 again
+void clearNames()
 {
-    return strncmp(str, prefix, strlen(prefix)) == 0;
+    nameCount = 0;
+    namePoolSize = 0;
+    if (nameBucketCount != 0)
+        rehashNames(nameBucketCount);
 }
 
-void tokenize()
+// random text of about size bytes made to be cut badly: short and overlong
+// names and numbers, comments of any length, some never closed, stray
+// comment markers, operators and invalid symbols
+int generateFuzz(char *text, int size)
 {
-    int i = 0;
+    static const char *pieces[] = {" ", "\n", "\t", "/*", "*/", "*", "/", ":=", ":", "<=", "<", ">=", ">", "!=", "!",
+                                   "=", ";", ",", ".", "(", ")", "+", "-", "$", "begin", "end", "while", "odd", "fi"};
+    int pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+    int n = 0;
 
-    while (source[i] != '\0')
+    while (n < size)
     {
-        // whitespace
-        if (source[i] == ' ' || source[i] == '\t' || source[i] == '\n' || source[i] == '\r' || source[i] == '\0')
+        int kind = rand() % 8;
+        if (kind == 0)
         {
-            i++;
-            continue;
+            int length = 1 + rand() % (rand() % 4 ? MAX_NAME_LENGTH : 80);
+            text[n++] = 'a' + rand() % 26;
+            for (int i = 1; i < length; i++)
+                text[n++] = rand() % 4 ? 'a' + rand() % 26 : '0' + rand() % 10;
         }
-
-        // reserved words
-        for (int j = 0; j < 14; j++)
+        else if (kind == 1)
         {
-            if (starts_with(&source[i], reserved_words[j]))
-            {
-                strcpy(tokens[tokenCount].value, reserved_words[j]);
-                tokens[tokenCount].type = KEYWORD;
-                tokenCount++;
-                i += strlen(reserved_words[j]);
-                continue;
-            }
+            int length = 1 + rand() % (rand() % 4 ? MAX_NUMBER_LENGTH : 12);
+            for (int i = 0; i < length; i++)
+                text[n++] = '0' + rand() % 10;
         }
-
-        // symbols
-        for (int j = 0; j < 17; j++)
+        else if (kind == 2)
         {
-            if (starts_with(&source[i], symbols[j]))
-            {
-                strcpy(tokens[tokenCount].value, symbols[j]);
-                tokens[tokenCount].type = SYMBOL;
-                tokenCount++;
-                i += strlen(symbols[j]);
-                continue;
-            }
+            static const char body[] = "abc xyz 123 * / ** // \n";
+            int length = rand() % (rand() % 4 ? 16 : 300);
+            n += sprintf(text + n, "/*");
+            for (int i = 0; i < length; i++)
+                text[n++] = body[rand() % (sizeof(body) - 1)];
+            if (rand() % 16)
+                n += sprintf(text + n, "*/");
         }
+        else
+            n += sprintf(text + n, "%s", pieces[rand() % pieceCount]);
+        if (rand() % 2)
+            text[n++] = ' ';
+    }
+    return n;
+}
 
-        // identifier
-        if (is_letter(source[i]))
-        {
-            int j = 0;
-            while (is_letter(source[i]) || is_digit(source[i]))
-            {
-                tokens[tokenCount].value[j] = source[i];
-                i++;
-                j++;
-            }
-            tokens[tokenCount].value[j] = '\0';
-            tokens[tokenCount].type = IDENTIFIER;
-            tokenCount++;
-            continue;
-        }
+// differential check of tokenizeParallel() against tokenize() on random
+// inputs cut into 2 to 31 chunks, returns 1 on any difference in the token
+// list or the name table, or when no chunk boundary fell inside a comment
+// or inside a lexeme
+int checkParallel(int inputs)
+{
+    char *text = malloc(2048 + 512);
+    long splits = 0, inComment = 0, inLexeme = 0;
+    int mismatches = 0;
+
+    srand(1);
+    for (int input = 0; input < inputs; input++)
+    {
+        int length = generateFuzz(text, 128 + rand() % 1920);
+
+        clearNames();
+        tokenCount = 0;
+        tokenize(text, length);
+        int serialCount = tokenCount, serialNameCount = nameCount, serialPoolSize = namePoolSize;
+        Token *serial = malloc((serialCount + 1) * sizeof(Token));
+        memcpy(serial, tokens, (serialCount + 1) * sizeof(Token));
+        char *serialPool = malloc(serialPoolSize + 1);
+        memcpy(serialPool, namePool, serialPoolSize);
 
-        // number
-        if (is_digit(source[i]))
+        // tokenizeParallel() uses no more than one chunk per 64 bytes
+        for (int threads = 2; threads <= 31 && threads <= length / 64; threads++)
         {
-            int j = 0;
-            while (is_digit(source[i]))
+            clearNames();
+            tokenCount = 0;
+            tokenizeParallel(text, length, threads);
+            int same = tokenCount == serialCount && memcmp(tokens, serial, (serialCount + 1) * sizeof(Token)) == 0 &&
+                       nameCount == serialNameCount && namePoolSize == serialPoolSize &&
+                       memcmp(namePool, serialPool, serialPoolSize) == 0;
+            if (!same && ++mismatches <= 10)
+                printf("  MISMATCH: input %d, %d bytes, %d threads\n", input, length, threads);
+
+            // where the chunk boundaries fell, from the scanner state there
+            Scanner scanner = {0};
+            initScanner(&scanner);
+            unsigned int at = 0;
+            for (int k = 1; k < threads; k++)
             {
-                tokens[tokenCount].value[j] = source[i];
-                i++;
-                j++;
+                unsigned int start = (long long)length * k / threads;
+                scanChunk(&scanner, text + at, start - at);
+                at = start;
+                if (scanner.state == S_COMMENT || scanner.state == S_COMMENT_STAR)
+                    inComment++;
+                else if (isLexemeState(scanner.state))
+                    inLexeme++;
             }
-            tokens[tokenCount].value[j] = '\0';
-            tokens[tokenCount].type = NUMBER;
-            tokenCount++;
-            continue;
+            free(scanner.carry);
+            splits++;
         }
+        free(serial);
+        free(serialPool);
+    }
+    free(text);
 
-        // comment
-        if (source[i] == '/')
+    printf("Parallel lexing check: %d inputs, %ld splits, %ld boundaries inside comments, %ld inside lexemes\n",
+           inputs, splits, inComment, inLexeme);
+    if (mismatches)
+        printf("  %d splits differ from serial lexing\n", mismatches);
+    else
+        printf("  identical to serial lexing\n");
+    return mismatches != 0 || inComment == 0 || inLexeme == 0;
+}
+
+// one random edit of text: a letter typed or removed, or a comment opened
+// or closed, applied to the buffer and then re-lexed. returns the seconds
+// relex() took
+double editAndRelex(char *text, int *length, int kind)
+{
+    int offset = rand() % *length, deleted = 0;
+    const char *inserted = "";
+    if (kind == 0)
+        inserted = "q";
+    else if (kind == 1)
+        deleted = 1;
+    else if (kind == 2)
+        inserted = "/*";
+    else
+        inserted = "*/";
+    int insertedLength = strlen(inserted);
+
+    memmove(text + offset + insertedLength, text + offset + deleted, *length - offset - deleted);
+    memcpy(text + offset, inserted, insertedLength);
+    *length += insertedLength - deleted;
+
+    double start = now();
+    relex(text, *length, offset, deleted, insertedLength);
+    return now() - start;
+}
+
+// per edit latency of relex() on a 100k line program against lexing it
+// all again, every result is checked against a full tokenize()
+void benchRelex()
+{
+    const char *kinds[] = {"insert a letter", "delete a byte", "open a comment", "close a comment"};
+    int length, lines = 0;
+    char *program = generateProgram(100000 * 29, &length);
+    for (int i = 0; i < length; i++)
+        lines += program[i] == '\n';
+
+    char *text = malloc(length + 4096);
+    memcpy(text, program, length);
+    tokenCount = 0;
+    tokenize(text, length);
+    double full = timeTokenize(text, length);
+    printf("\nIncremental re-lex: %d lines, %.1f MB, full lex %.3f ms\n", lines, length / 1048576.0, full * 1e3);
+
+    srand(1);
+    int mismatches = 0;
+    for (int kind = 0; kind < 4; kind++)
+    {
+        double total = 0, worst = 0;
+        int edits = 200;
+        for (int e = 0; e < edits; e++)
         {
-            if (source[i + 1] == '*')
-            {
-                i += 2;
-                while (source[i] != '*' && source[i + 1] != '/')
-                    i++;
-                i += 2;
-                continue;
-            }
+            double elapsed = editAndRelex(text, &length, kind);
+            total += elapsed;
+            if (elapsed > worst)
+                worst = elapsed;
+
+            int count = tokenCount;
+            Token *incremental = malloc((count + 1) * sizeof(Token));
+            memcpy(incremental, tokens, (count + 1) * sizeof(Token));
+            tokenCount = 0;
+            tokenize(text, length);
+            mismatches += count != tokenCount || memcmp(incremental, tokens, (count + 1) * sizeof(Token)) != 0;
+            free(incremental);
         }
+        printf("  %-16s mean %.3f ms  worst %.3f ms  %.0fx faster\n", kinds[kind], total / edits * 1e3, worst * 1e3, full / (total / edits));
+    }
+    printf("  %s\n", mismatches ? "MISMATCH against full lexing" : "identical to full lexing");
+    free(text);
+    free(program);
+}
+
+void runBenchmark(int megabytes)
+{
+    int length;
+    char *text = generateProgram(megabytes * 1024 * 1024, &length);
+
+    // warm up once so the token array is already grown
+    tokenize(text, length);
 
-        // single character symbols
-        if (isSymbol(source[i]))
+    double best = timeTokenize(text, length);
+    printf("Lexer benchmark: %.1f MB, %d tokens\n", length / 1048576.0, tokenCount);
+    printf("  %.3f s  %.1f MB/s  %.1f Mtokens/s\n", best, length / 1048576.0 / best, tokenCount / 1e6 / best);
+    free(text);
+
+    // scalar against vector run kernels
+    int detected = detectScanKernels();
+    for (int comments = 1; comments >= 0; comments--)
+    {
+        text = generateRuns(megabytes * 1024 * 1024, &length, comments);
+        printf("\n%s heavy input: %.1f MB\n", comments ? "Comment" : "Identifier", length / 1048576.0);
+        for (int level = SCAN_SCALAR; level <= detected; level++)
         {
-            tokens[tokenCount].value[0] = source[i];
-            tokens[tokenCount].value[1] = '\0';
-            tokens[tokenCount].type = SYMBOL;
-            tokenCount++;
-            i++;
-            continue;
+            selectScanKernels(level);
+            best = timeTokenize(text, length);
+            printf("  %-8s %.3f s  %.1f MB/s\n", scanKernelNames[level], best, length / 1048576.0 / best);
         }
-
-        i++;
+        selectScanKernels(detected);
+        free(text);
     }
+    benchKeywords();
+    benchParallel(megabytes);
+    benchRelex();
 }
 
-void readFile(char *filename)
+void printTokenList()
 {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL)
+    for (int i = 0; i < tokenCount; i++)
     {
-        printf("Error: Could not open file\n");
-        exit(1);
+        if (tokens[i].type == identsym)
+            printf("%d %s ", identsym, nameText(tokens[i].val));
+        else if (tokens[i].type == numbersym)
+            printf("%d %d ", numbersym, tokens[i].val);
+        else if (tokens[i].type < LONG_NAME)
+            printf("%d ", tokens[i].type);
     }
-    char c;
-    int i = 0;
-    while ((c = fgetc(file)) != EOF)
-        source[i++] = c;
-    source[i] = '\0';
-    fclose(file);
 }
 
-int getKeywordValue(char *keyword)
+// pipes and stdin: print the token list as the input arrives, only the
+// tokens of the current chunk are ever kept in memory
+void streamTokenList(SourceFile *file)
 {
-    if (strcmp(keyword, "const") == 0)
-        return constsym;
-    else if (strcmp(keyword, "var") == 0)
-        return varsym;
-    else if (strcmp(keyword, "procedure") == 0)
-        return procsym;
-    else if (strcmp(keyword, "call") == 0)
-        return callsym;
-    else if (strcmp(keyword, "begin") == 0)
-        return beginsym;
-    else if (strcmp(keyword, "end") == 0)
-        return endsym;
-    else if (strcmp(keyword, "if") == 0)
-        return ifsym;
-    else if (strcmp(keyword, "fi") == 0)
-        return thensym;
-    else if (strcmp(keyword, "then") == 0)
-        return thensym;
-    else if (strcmp(keyword, "else") == 0)
-        return elsesym;
-    else if (strcmp(keyword, "while") == 0)
-        return whilesym;
-    else if (strcmp(keyword, "do") == 0)
-        return dosym;
-    else if (strcmp(keyword, "read") == 0)
-        return readsym;
-    else if (strcmp(keyword, "write") == 0)
-        return writesym;
-    else
-        return -1;
+    Scanner scanner = {0};
+    char *chunk = malloc(SOURCE_CHUNK_SIZE);
+    int n;
+
+    printf("Token List:\n");
+    initScanner(&scanner);
+    while ((n = readSource(file, chunk, SOURCE_CHUNK_SIZE)) > 0)
+    {
+        scanChunk(&scanner, chunk, n);
+        printTokenList();
+        tokenCount = 0;
+    }
+    finishScanner(&scanner);
+    printTokenList();
+    printf("\n");
+    free(scanner.carry);
+    free(chunk);
 }
 
-int getSymbolValue(char *symbol)
+// whole contents of a streamed source
+char *readAll(SourceFile *file, int *length)
 {
-    if (strcmp(symbol, "+") == 0)
-        return plussym;
-    else if (strcmp(symbol, "-") == 0)
-        return minussym;
-    else if (strcmp(symbol, "*") == 0)
-        return multsym;
-    else if (strcmp(symbol, "/") == 0)
-        return slashsym;
-    else if (strcmp(symbol, "(") == 0)
-        return lparentsym;
-    else if (strcmp(symbol, ")") == 0)
-        return rparentsym;
-    else if (strcmp(symbol, "=") == 0)
-        return eqsym;
-    else if (strcmp(symbol, ",") == 0)
-        return commasym;
-    else if (strcmp(symbol, ".") == 0)
-        return periodsym;
-    else if (strcmp(symbol, "<") == 0)
-        return lessym;
-    else if (strcmp(symbol, ">") == 0)
-        return gtrsym;
-    else if (strcmp(symbol, ";") == 0)
-        return semicolonsym;
-    else if (strcmp(symbol, ":=") == 0)
-        return becomessym;
-    else if (strcmp(symbol, "<=") == 0)
-        return leqsym;
-    else if (strcmp(symbol, ">=") == 0)
-        return geqsym;
-    else if (strcmp(symbol, "!=") == 0)
-        return neqsym;
-    else
-        return -1;
+    char *text = NULL;
+    int capacity = 0, n;
+    *length = 0;
+    do
+    {
+        text = growArray(text, &capacity, *length + SOURCE_CHUNK_SIZE, 1);
+        n = readSource(file, text + *length, SOURCE_CHUNK_SIZE);
+        *length += n;
+    } while (n > 0);
+    return text;
 }
 
 int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        printf("Usage: %s <input>\n", argv[0]);
+        printf("Usage: %s <input | ->\n", argv[0]);
+        printf("       %s [--threads <n>] [-o <token file>] <input | ->\n", argv[0]);
+        printf("       %s --bench [megabytes]\n", argv[0]);
+        printf("       %s --check [inputs]\n", argv[0]);
         return 1;
     }
 
-    // read file
-    readFile(argv[1]);
+    int threadCount = 1;
+    char *outputName = NULL;
+    while (argc > 3 && (strcmp(argv[1], "--threads") == 0 || strcmp(argv[1], "-o") == 0))
+    {
+        if (strcmp(argv[1], "--threads") == 0)
+            threadCount = atoi(argv[2]);
+        else
+            outputName = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (strcmp(argv[1], "--bench") == 0)
+    {
+        runBenchmark(argc > 2 ? atoi(argv[2]) : 16);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "--check") == 0)
+        return checkParallel(argc > 2 ? atoi(argv[2]) : 1000);
+
+    SourceFile file;
+    openSource(&file, argv[1]);
+
+    if (file.data == NULL && outputName == NULL)
+    {
+        streamTokenList(&file);
+        closeSource(&file);
+        return 0;
+    }
+
+    // tokenize, a token file needs the whole source even from a pipe
+    char *source = file.data;
+    int sourceLength = file.length;
+    if (source == NULL)
+        source = readAll(&file, &sourceLength);
+    if (threadCount > 1)
+        tokenizeParallel(source, sourceLength, threadCount);
+    else
+        tokenize(source, sourceLength);
 
-    // tokenize
-    tokenize();
+    if (outputName != NULL)
+    {
+        if (!writeTokenFile(outputName, source, sourceLength))
+        {
+            printf("Error: Could not write token file\n");
+            return 1;
+        }
+        closeSource(&file);
+        return 0;
+    }
 
     // print source from tokens
-    printf("Source Program:\n%s\n", source);
+    printf("Source Program:\n");
+    fwrite(source, 1, sourceLength, stdout);
+    printf("\n");
 
     // print lexeme table
     printf("\nLexeme Table:\n");
     printf("%-15s %s\n", "lexeme", "token type");
     for (int i = 0; i < tokenCount; i++)
     {
-        printf("%-15s ", tokens[i].value);
-        if (tokens[i].type == KEYWORD)
-        {
-            printf("%d\n", getKeywordValue(tokens[i].value));
-        }
-        else if (tokens[i].type == IDENTIFIER)
-        {
-            // check if length is greater than 11
-            if (strlen(tokens[i].value) > 11)
-                printf("Error: Name is too long\n");
-            else
-                printf("%d\n", identsym);
-        }
-        else if (tokens[i].type == NUMBER)
-        {
-            if (strlen(tokens[i].value) > 5)
-                printf("Error: Number is too long\n");
-            else
-                printf("%d\n", numbersym);
-        }
-        else if (tokens[i].type == SYMBOL)
-        {
-            int value = getSymbolValue(tokens[i].value);
-            if (value == -1)
-                printf("Error: Invalid symbol\n");
-            else
-                printf("%d\n", value);
-        }
+        int length = tokenLength(tokens[i], source, sourceLength);
+        printf("%-15.*s ", length, source + tokens[i].offset);
+        if (tokens[i].type == LONG_NAME)
+            printf("Error: Name is too long\n");
+        else if (tokens[i].type == LONG_NUMBER)
+            printf("Error: Number is too long\n");
+        else if (tokens[i].type == INVALID_SYMBOL)
+            printf("Error: Invalid symbol\n");
+        else
+            printf("%d\n", tokens[i].type);
     }
 
     // print lexeme list
     printf("\nToken List:\n");
-    for (int i = 0; i < tokenCount; i++)
-    {
-        if (tokens[i].type == KEYWORD)
-        {
-            printf("%d ", getKeywordValue(tokens[i].value));
-        }
-        else if (tokens[i].type == IDENTIFIER)
-        {
-            if (strlen(tokens[i].value) > 11)
-                continue;
-            printf("%d %s ", identsym, tokens[i].value);
-        }
-        else if (tokens[i].type == NUMBER)
-        {
-            if (strlen(tokens[i].value) > 5)
-                continue;
-            printf("%d %s ", numbersym, tokens[i].value);
-        }
-        else if (tokens[i].type == SYMBOL)
-        {
-            int value = getSymbolValue(tokens[i].value);
-            if (value != -1)
-                printf("%d ", value);
-        }
-    }
+    printTokenList();
     printf("\n");
 
+    closeSource(&file);
     return 0;
 }
\ No newline at end of file
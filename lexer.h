@@ -0,0 +1,1300 @@
+// lexer.h - table driven pl0 scanner shared by lexer.c and parser-codegen.c
+//
+// every source byte is mapped to a character class once, and a small
+// deterministic automaton over (state, class) decides whether the byte extends
+// the current lexeme or ends it. identifiers are scanned whole and only then
+// checked against the reserved words, so "endx" or "dox" stay identifiers.
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(NO_SIMD)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+typedef enum
+{
+    skipsym = 1,
+    identsym,
+    numbersym,
+    plussym,
+    minussym,
+    multsym,
+    slashsym,
+    fisym,
+    eqsym,
+    neqsym,
+    lessym,
+    leqsym,
+    gtrsym,
+    geqsym,
+    lparentsym,
+    rparentsym,
+    commasym,
+    semicolonsym,
+    periodsym,
+    becomessym,
+    beginsym,
+    endsym,
+    ifsym,
+    thensym,
+    whilesym,
+    dosym,
+    callsym,
+    constsym,
+    varsym,
+    procsym,
+    writesym,
+    readsym,
+    elsesym,
+    oddsym, // modified
+} token_type;
+
+#include "keywords.h"
+
+// lexical errors, kept in the token stream so they are reported in order
+enum
+{
+    LONG_NAME = 64,
+    LONG_NUMBER,
+    INVALID_SYMBOL
+};
+
+#define MAX_NAME_LENGTH 11
+#define MAX_NUMBER_LENGTH 5
+
+// 8 bytes per token: keywords and symbols are resolved to their token_type
+// while scanning, identifiers carry an interned name id and numbers their
+// value, the lexeme itself can always be found again through offset
+typedef struct
+{
+    unsigned int offset;   // byte offset of the lexeme in the source
+    unsigned int type : 8; // token_type or lexical error
+    unsigned int val : 24; // identsym and errors: name id, numbersym: value
+} Token;
+
+// tokens and names are per thread so tokenizeParallel() can scan chunks of
+// one buffer side by side, single threaded users never notice
+_Thread_local Token *tokens = NULL;
+_Thread_local int tokenCount = 0;
+_Thread_local int tokenCapacity = 0;
+
+// interned names, ids start at 1 so 0 can mean "no name"
+typedef struct
+{
+    int offset; // into namePool, names are '\0' terminated
+    int length;
+    int next;   // next name in the same hash bucket
+} Name;
+
+_Thread_local char *namePool = NULL;
+_Thread_local int namePoolSize = 0;
+_Thread_local int namePoolCapacity = 0;
+
+_Thread_local Name *names = NULL;
+_Thread_local int nameCount = 0;
+_Thread_local int nameCapacity = 0;
+
+_Thread_local int *nameBuckets = NULL;
+_Thread_local int nameBucketCount = 0;
+
+// character classes
+enum
+{
+    C_BLANK,   // whitespace and bytes that are silently skipped
+    C_LETTER,  // a-z A-Z
+    C_DIGIT,   // 0-9
+    C_SLASH,   // /
+    C_STAR,    // *
+    C_COLON,   // :
+    C_LESS,    // <
+    C_GREATER, // >
+    C_BANG,    // !
+    C_EQUAL,   // =
+    C_PUNCT,   // + - ( ) , . ;
+    C_OTHER,   // anything else is an invalid one character symbol
+    C_COUNT
+};
+
+// scanner states, S_ACCEPT is not a real state: it ends the current lexeme
+// without consuming the byte that was looked at
+enum
+{
+    S_START,
+    S_IDENT,
+    S_NUMBER,
+    S_SLASH,
+    S_COMMENT,
+    S_COMMENT_STAR,
+    S_COLON,
+    S_LESS,
+    S_GREATER,
+    S_BANG,
+    S_PUNCT,    // complete one character symbol
+    S_OPERATOR, // complete two character symbol
+    S_INVALID,  // complete invalid symbol
+    S_COUNT,
+    S_ACCEPT = S_COUNT
+};
+
+unsigned char charClass[256];
+
+const unsigned char transitions[S_COUNT][C_COUNT] = {
+    //                   blank      letter     digit      /          *               :          <          >          !          =           punct      other
+    [S_START]        = {S_START,   S_IDENT,   S_NUMBER,  S_SLASH,   S_PUNCT,        S_COLON,   S_LESS,    S_GREATER, S_BANG,    S_PUNCT,    S_PUNCT,   S_INVALID},
+    [S_IDENT]        = {S_ACCEPT,  S_IDENT,   S_IDENT,   S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,   S_ACCEPT,  S_ACCEPT},
+    [S_NUMBER]       = {S_ACCEPT,  S_ACCEPT,  S_NUMBER,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,   S_ACCEPT,  S_ACCEPT},
+    [S_SLASH]        = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_COMMENT,      S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,   S_ACCEPT,  S_ACCEPT},
+    [S_COMMENT]      = {S_COMMENT, S_COMMENT, S_COMMENT, S_COMMENT, S_COMMENT_STAR, S_COMMENT, S_COMMENT, S_COMMENT, S_COMMENT, S_COMMENT,  S_COMMENT, S_COMMENT},
+    [S_COMMENT_STAR] = {S_COMMENT, S_COMMENT, S_COMMENT, S_START,   S_COMMENT_STAR, S_COMMENT, S_COMMENT, S_COMMENT, S_COMMENT, S_COMMENT,  S_COMMENT, S_COMMENT},
+    [S_COLON]        = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_OPERATOR, S_ACCEPT,  S_ACCEPT},
+    [S_LESS]         = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_OPERATOR, S_ACCEPT,  S_ACCEPT},
+    [S_GREATER]      = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_OPERATOR, S_ACCEPT,  S_ACCEPT},
+    [S_BANG]         = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_OPERATOR, S_ACCEPT,  S_ACCEPT},
+    [S_PUNCT]        = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,   S_ACCEPT,  S_ACCEPT},
+    [S_OPERATOR]     = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,   S_ACCEPT,  S_ACCEPT},
+    [S_INVALID]      = {S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,       S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,  S_ACCEPT,   S_ACCEPT,  S_ACCEPT},
+};
+
+void initCharClasses()
+{
+    // bytes that are neither letters, digits, whitespace nor '_' were
+    // historically lexed as (invalid) symbols
+    for (int c = 0; c < 256; c++)
+        charClass[c] = C_OTHER;
+    for (int c = 'a'; c <= 'z'; c++)
+        charClass[c] = C_LETTER;
+    for (int c = 'A'; c <= 'Z'; c++)
+        charClass[c] = C_LETTER;
+    for (int c = '0'; c <= '9'; c++)
+        charClass[c] = C_DIGIT;
+    charClass['\0'] = C_BLANK;
+    charClass[' '] = C_BLANK;
+    charClass['\t'] = C_BLANK;
+    charClass['\n'] = C_BLANK;
+    charClass['\r'] = C_BLANK;
+    charClass['\v'] = C_BLANK;
+    charClass['\f'] = C_BLANK;
+    charClass['_'] = C_BLANK;
+    charClass['/'] = C_SLASH;
+    charClass['*'] = C_STAR;
+    charClass[':'] = C_COLON;
+    charClass['<'] = C_LESS;
+    charClass['>'] = C_GREATER;
+    charClass['!'] = C_BANG;
+    charClass['='] = C_EQUAL;
+    charClass['+'] = C_PUNCT;
+    charClass['-'] = C_PUNCT;
+    charClass['('] = C_PUNCT;
+    charClass[')'] = C_PUNCT;
+    charClass[','] = C_PUNCT;
+    charClass['.'] = C_PUNCT;
+    charClass[';'] = C_PUNCT;
+}
+
+void *growArray(void *array, int *capacity, int needed, int elementSize)
+{
+    if (needed <= *capacity)
+        return array;
+    int newCapacity = *capacity ? *capacity : 1024;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+    array = realloc(array, (size_t)newCapacity * elementSize);
+    if (array == NULL)
+    {
+        printf("Error: Out of memory\n");
+        exit(1);
+    }
+    *capacity = newCapacity;
+    return array;
+}
+
+unsigned int hashName(const char *text, int length)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    return hash;
+}
+
+void rehashNames(int bucketCount)
+{
+    free(nameBuckets);
+    nameBuckets = calloc(bucketCount, sizeof(int));
+    nameBucketCount = bucketCount;
+    for (int id = 1; id <= nameCount; id++)
+    {
+        int bucket = hashName(namePool + names[id].offset, names[id].length) & (bucketCount - 1);
+        names[id].next = nameBuckets[bucket];
+        nameBuckets[bucket] = id;
+    }
+}
+
+int internName(const char *text, int length)
+{
+    if (nameBucketCount == 0)
+        rehashNames(1024);
+
+    int bucket = hashName(text, length) & (nameBucketCount - 1);
+    for (int id = nameBuckets[bucket]; id != 0; id = names[id].next)
+    {
+        if (names[id].length == length && memcmp(namePool + names[id].offset, text, length) == 0)
+            return id;
+    }
+
+    int id = ++nameCount;
+    names = growArray(names, &nameCapacity, nameCount + 1, sizeof(Name));
+    namePool = growArray(namePool, &namePoolCapacity, namePoolSize + length + 1, 1);
+    memcpy(namePool + namePoolSize, text, length);
+    namePool[namePoolSize + length] = '\0';
+    names[id].offset = namePoolSize;
+    names[id].length = length;
+    names[id].next = nameBuckets[bucket];
+    nameBuckets[bucket] = id;
+    namePoolSize += length + 1;
+
+    if (nameCount > nameBucketCount)
+        rehashNames(nameBucketCount * 2);
+    return id;
+}
+
+char *nameText(int id)
+{
+    return namePool + names[id].offset;
+}
+
+int nameLength(int id)
+{
+    return names[id].length;
+}
+
+// reserved word lookup: one perfect hash probe and one compare, see mkkeywords.c
+int getKeywordValue(const char *text, int length)
+{
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH)
+        return -1;
+    unsigned int h = keywordHash(text, length);
+    if (keywordTable[h].length == length && memcmp(text, keywordTable[h].text, length) == 0)
+        return keywordTable[h].type;
+    return -1;
+}
+
+// token_type of a complete one character symbol
+int getSymbolValue(char c)
+{
+    int type = oneCharSymbols[(unsigned char)c];
+    return type ? type : INVALID_SYMBOL;
+}
+
+void addToken(int state, const char *text, int length, unsigned int offset)
+{
+    tokens = growArray(tokens, &tokenCapacity, tokenCount + 2, sizeof(Token));
+
+    Token *token = &tokens[tokenCount++];
+    token->offset = offset;
+    token->val = 0;
+
+    switch (state)
+    {
+    case S_IDENT:
+    {
+        int keyword = getKeywordValue(text, length);
+        if (keyword != -1)
+            token->type = keyword;
+        else
+        {
+            token->type = length > MAX_NAME_LENGTH ? LONG_NAME : identsym;
+            token->val = internName(text, length);
+        }
+        break;
+    }
+    case S_NUMBER:
+        if (length > MAX_NUMBER_LENGTH)
+        {
+            token->type = LONG_NUMBER;
+            token->val = internName(text, length);
+        }
+        else
+        {
+            int value = 0;
+            for (int i = 0; i < length; i++)
+                value = value * 10 + (text[i] - '0');
+            token->type = numbersym;
+            token->val = value;
+        }
+        break;
+    case S_OPERATOR:
+        // := <= >= !=
+        token->type = twoCharSymbols[(unsigned char)text[0]];
+        break;
+    case S_COLON:
+    case S_BANG:
+    case S_INVALID:
+        token->type = INVALID_SYMBOL;
+        token->val = internName(text, length);
+        break;
+    default:
+        // S_PUNCT, S_SLASH, S_LESS, S_GREATER
+        token->type = getSymbolValue(text[0]);
+        break;
+    }
+}
+
+// run kernels: each returns the index of the first byte at or after i that
+// does not continue the run, or length. the scalar versions go through the
+// character class table, the vector ones test 16 (SSE2) or 32 (AVX2) bytes
+// per step and finish the tail with the scalar loop
+typedef int (*RunKernel)(const char *text, int i, int length);
+
+int blankRunScalar(const char *text, int i, int length)
+{
+    while (i < length && charClass[(unsigned char)text[i]] == C_BLANK)
+        i++;
+    return i;
+}
+
+int identRunScalar(const char *text, int i, int length)
+{
+    while (i < length && (charClass[(unsigned char)text[i]] == C_LETTER || charClass[(unsigned char)text[i]] == C_DIGIT))
+        i++;
+    return i;
+}
+
+int digitRunScalar(const char *text, int i, int length)
+{
+    while (i < length && charClass[(unsigned char)text[i]] == C_DIGIT)
+        i++;
+    return i;
+}
+
+// comment text runs up to the next '*'
+int commentRunScalar(const char *text, int i, int length)
+{
+    while (i < length && text[i] != '*')
+        i++;
+    return i;
+}
+
+#ifdef SCAN_X86
+
+// lo <= c <= lo + span, compared as unsigned bytes
+__m128i inRange128(__m128i c, char lo, char span)
+{
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(span)), d);
+}
+
+// the C_BLANK bytes: ' ', '\t' .. '\r', '_' and '\0'
+__m128i blankMask128(__m128i c)
+{
+    __m128i mask = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(c, _mm_setzero_si128()));
+    return _mm_or_si128(mask, inRange128(c, '\t', '\r' - '\t'));
+}
+
+__m128i identMask128(__m128i c)
+{
+    return _mm_or_si128(inRange128(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 25), inRange128(c, '0', 9));
+}
+
+__m128i digitMask128(__m128i c)
+{
+    return inRange128(c, '0', 9);
+}
+
+__m128i notStarMask128(__m128i c)
+{
+    return _mm_xor_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('*')), _mm_set1_epi8(-1));
+}
+
+__attribute__((target("avx2"))) __m256i inRange256(__m256i c, char lo, char span)
+{
+    __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(span)), d);
+}
+
+__attribute__((target("avx2"))) __m256i blankMask256(__m256i c)
+{
+    __m256i mask = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(c, _mm256_setzero_si256()));
+    return _mm256_or_si256(mask, inRange256(c, '\t', '\r' - '\t'));
+}
+
+__attribute__((target("avx2"))) __m256i identMask256(__m256i c)
+{
+    return _mm256_or_si256(inRange256(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), 'a', 25), inRange256(c, '0', 9));
+}
+
+__attribute__((target("avx2"))) __m256i digitMask256(__m256i c)
+{
+    return inRange256(c, '0', 9);
+}
+
+__attribute__((target("avx2"))) __m256i notStarMask256(__m256i c)
+{
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('*')), _mm256_set1_epi8(-1));
+}
+
+// MASK marks the bytes that continue the run; SSE2 is part of x86-64, so
+// only the AVX2 versions need a cpu check
+#define SSE2_KERNEL(name, MASK, scalar)                                         \
+    int name(const char *text, int i, int length)                               \
+    {                                                                           \
+        while (i + 16 <= length)                                                \
+        {                                                                       \
+            __m128i c = _mm_loadu_si128((const __m128i *)(text + i));           \
+            unsigned int stop = ~_mm_movemask_epi8(MASK(c)) & 0xffff;           \
+            if (stop)                                                           \
+                return i + __builtin_ctz(stop);                                 \
+            i += 16;                                                            \
+        }                                                                       \
+        return scalar(text, i, length);                                         \
+    }
+
+// most runs are short, so the AVX2 versions look at 16 bytes first and only
+// then switch to 32 byte steps
+#define AVX2_KERNEL(name, MASK128, MASK, scalar)                                \
+    __attribute__((target("avx2"))) int name(const char *text, int i, int length) \
+    {                                                                           \
+        if (i + 16 <= length)                                                   \
+        {                                                                       \
+            __m128i c = _mm_loadu_si128((const __m128i *)(text + i));           \
+            unsigned int stop = ~_mm_movemask_epi8(MASK128(c)) & 0xffff;        \
+            if (stop)                                                           \
+                return i + __builtin_ctz(stop);                                 \
+            i += 16;                                                            \
+        }                                                                       \
+        while (i + 32 <= length)                                                \
+        {                                                                       \
+            __m256i c = _mm256_loadu_si256((const __m256i *)(text + i));        \
+            unsigned int stop = ~(unsigned int)_mm256_movemask_epi8(MASK(c));   \
+            if (stop)                                                           \
+                return i + __builtin_ctz(stop);                                 \
+            i += 32;                                                            \
+        }                                                                       \
+        return scalar(text, i, length);                                         \
+    }
+
+SSE2_KERNEL(blankRunSse2, blankMask128, blankRunScalar)
+SSE2_KERNEL(identRunSse2, identMask128, identRunScalar)
+SSE2_KERNEL(digitRunSse2, digitMask128, digitRunScalar)
+SSE2_KERNEL(commentRunSse2, notStarMask128, commentRunScalar)
+
+AVX2_KERNEL(blankRunAvx2, blankMask128, blankMask256, blankRunScalar)
+AVX2_KERNEL(identRunAvx2, identMask128, identMask256, identRunScalar)
+AVX2_KERNEL(digitRunAvx2, digitMask128, digitMask256, digitRunScalar)
+AVX2_KERNEL(commentRunAvx2, notStarMask128, notStarMask256, commentRunScalar)
+
+#endif
+
+enum
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+};
+
+char *scanKernelNames[] = {"scalar", "sse2", "avx2"};
+
+RunKernel blankRun = blankRunScalar;
+RunKernel identRun = identRunScalar;
+RunKernel digitRun = digitRunScalar;
+RunKernel commentRun = commentRunScalar;
+
+// best kernel set this machine supports
+int detectScanKernels()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SCAN_AVX2;
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+void selectScanKernels(int level)
+{
+    blankRun = blankRunScalar;
+    identRun = identRunScalar;
+    digitRun = digitRunScalar;
+    commentRun = commentRunScalar;
+#ifdef SCAN_X86
+    if (level == SCAN_SSE2)
+    {
+        blankRun = blankRunSse2;
+        identRun = identRunSse2;
+        digitRun = digitRunSse2;
+        commentRun = commentRunSse2;
+    }
+    else if (level == SCAN_AVX2)
+    {
+        blankRun = blankRunAvx2;
+        identRun = identRunAvx2;
+        digitRun = digitRunAvx2;
+        commentRun = commentRunAvx2;
+    }
+#else
+    (void)level;
+#endif
+}
+
+// scanner state carried from one chunk of input to the next, so a lexeme
+// or comment may straddle chunk boundaries
+typedef struct
+{
+    int state;
+    unsigned int offset;        // stream offset of the next chunk
+    unsigned int lexemeOffset;  // stream offset of the carried lexeme
+    char *carry;                // start of a lexeme cut off by the chunk end
+    int carryLength;
+    int carryCapacity;
+} Scanner;
+
+void initScanner(Scanner *scanner)
+{
+    if (charClass['a'] != C_LETTER)
+    {
+        initCharClasses();
+        selectScanKernels(detectScanKernels());
+    }
+    scanner->state = S_START;
+    scanner->offset = 0;
+    scanner->lexemeOffset = 0;
+    scanner->carryLength = 0;
+}
+
+void carryLexeme(Scanner *scanner, const char *text, int length)
+{
+    scanner->carry = growArray(scanner->carry, &scanner->carryCapacity, scanner->carryLength + length, 1);
+    memcpy(scanner->carry + scanner->carryLength, text, length);
+    scanner->carryLength += length;
+}
+
+int isLexemeState(int state)
+{
+    return state != S_START && state != S_COMMENT && state != S_COMMENT_STAR;
+}
+
+void finishScanner(Scanner *scanner)
+{
+    // lexeme running into the end of the input, an unterminated comment is dropped
+    if (isLexemeState(scanner->state))
+        addToken(scanner->state, scanner->carry, scanner->carryLength, scanner->lexemeOffset);
+    scanner->state = S_START;
+    scanner->carryLength = 0;
+
+    // the parser may look one token past the end
+    tokens = growArray(tokens, &tokenCapacity, tokenCount + 1, sizeof(Token));
+    tokens[tokenCount].offset = scanner->offset;
+    tokens[tokenCount].type = 0;
+    tokens[tokenCount].val = 0;
+}
+
+// scan the next length bytes of input, appending complete tokens to tokens[]
+void scanChunk(Scanner *scanner, const char *chunk, int length)
+{
+    int state = scanner->state;
+    int start = 0;
+    int i = 0;
+
+    if (isLexemeState(state))
+    {
+        // finish the lexeme the previous chunk ended in
+        while (i < length)
+        {
+            int next = transitions[state][charClass[(unsigned char)chunk[i]]];
+            if (next == S_ACCEPT)
+                break;
+            state = next;
+            i++;
+            if (state == S_COMMENT)
+                break;
+        }
+        if (state == S_COMMENT)
+            scanner->carryLength = 0;
+        else
+        {
+            carryLexeme(scanner, chunk, i);
+            if (i == length)
+            {
+                scanner->state = state;
+                scanner->offset += length;
+                return;
+            }
+            addToken(state, scanner->carry, scanner->carryLength, scanner->lexemeOffset);
+            scanner->carryLength = 0;
+            state = S_START;
+        }
+    }
+
+    while (i < length)
+    {
+        int next = transitions[state][charClass[(unsigned char)chunk[i]]];
+        if (next == S_ACCEPT)
+        {
+            addToken(state, chunk + start, i - start, scanner->offset + start);
+            state = S_START;
+            continue;
+        }
+        if (state == S_START)
+            start = i;
+        state = next;
+        i++;
+
+        // runs of blanks, identifier or number characters and comment text
+        // are skipped a vector at a time
+        if (state == S_START)
+            i = blankRun(chunk, i, length);
+        else if (state == S_IDENT)
+            i = identRun(chunk, i, length);
+        else if (state == S_NUMBER)
+            i = digitRun(chunk, i, length);
+        else if (state == S_COMMENT)
+            i = commentRun(chunk, i, length);
+    }
+
+    if (isLexemeState(state))
+    {
+        scanner->lexemeOffset = scanner->offset + start;
+        carryLexeme(scanner, chunk + start, length - start);
+    }
+    scanner->state = state;
+    scanner->offset += length;
+}
+
+// tokenize a complete buffer
+void tokenize(const char *source, int length)
+{
+    Scanner scanner = {0};
+    initScanner(&scanner);
+    scanChunk(&scanner, source, length);
+    finishScanner(&scanner);
+    free(scanner.carry);
+}
+
+// one chunk of a buffer lexed by tokenizeParallel(), with the tokens and
+// names its worker thread produced
+typedef struct
+{
+    const char *source;
+    unsigned int start, end; // bytes of source in this chunk
+    int guess;               // assumed state at start, S_START or S_COMMENT
+    Scanner scanner;         // speculative state at end
+    Token *tokens;
+    int tokenCount;
+    Name *names;
+    char *namePool;
+    int nameCount;
+    int *nameBuckets;
+} LexChunk;
+
+// guess whether a chunk starts inside a comment from the closest comment
+// marker before it, looking back at most 4 KB
+int guessInComment(const char *source, unsigned int at)
+{
+    unsigned int stop = at > 4096 ? at - 4096 : 0;
+    for (unsigned int i = at; i >= stop + 2; i--)
+    {
+        if (source[i - 2] == '*' && source[i - 1] == '/')
+            return 0;
+        if (source[i - 2] == '/' && source[i - 1] == '*')
+            return 1;
+    }
+    return 0;
+}
+
+void *lexChunkWorker(void *arg)
+{
+    LexChunk *chunk = arg;
+
+    // a new thread starts with empty tokens[] and names
+    chunk->scanner.state = chunk->guess;
+    chunk->scanner.offset = chunk->start;
+    scanChunk(&chunk->scanner, chunk->source + chunk->start, chunk->end - chunk->start);
+
+    // hand the thread's tables over to the stitching pass
+    chunk->tokens = tokens;
+    chunk->tokenCount = tokenCount;
+    chunk->names = names;
+    chunk->namePool = namePool;
+    chunk->nameCount = nameCount;
+    chunk->nameBuckets = nameBuckets;
+    return NULL;
+}
+
+// append a chunk's speculative tokens from index keep on, with their
+// names interned in the calling thread's table in order of appearance
+void appendChunkTokens(LexChunk *chunk, int keep)
+{
+    int *remap = calloc(chunk->nameCount + 1, sizeof(int));
+    tokens = growArray(tokens, &tokenCapacity, tokenCount + chunk->tokenCount - keep + 1, sizeof(Token));
+    for (int i = keep; i < chunk->tokenCount; i++)
+    {
+        Token token = chunk->tokens[i];
+        if (token.type == identsym || token.type >= LONG_NAME)
+        {
+            int id = token.val;
+            if (remap[id] == 0)
+                remap[id] = internName(chunk->namePool + chunk->names[id].offset, chunk->names[id].length);
+            token.val = remap[id];
+        }
+        tokens[tokenCount++] = token;
+    }
+    free(remap);
+}
+
+// tokenize a complete buffer on up to threadCount threads, the result in
+// tokens[] and the name ids are exactly those of tokenize()
+//
+// every chunk is scanned on its own thread, guessing whether it starts in a
+// comment. the serial pass then walks the chunks in order with the true
+// scanner state: where it differs from the guess, or a lexeme was cut by the
+// boundary, the chunk is rescanned from its start one speculative token at a
+// time until the true scanner sits at a token start in the start state. from
+// there both agree, so the rest of the speculative tokens are kept
+void tokenizeParallel(const char *source, int length, int threadCount)
+{
+    int chunkCount = threadCount;
+    if (chunkCount > length / 64)
+        chunkCount = length / 64;
+    if (chunkCount <= 1)
+    {
+        tokenize(source, length);
+        return;
+    }
+
+    Scanner truth = {0};
+    initScanner(&truth);
+
+    LexChunk *chunks = calloc(chunkCount, sizeof(LexChunk));
+    pthread_t *threads = malloc(chunkCount * sizeof(pthread_t));
+    for (int k = 0; k < chunkCount; k++)
+    {
+        chunks[k].source = source;
+        chunks[k].start = (long long)length * k / chunkCount;
+        chunks[k].end = (long long)length * (k + 1) / chunkCount;
+        chunks[k].guess = k > 0 && guessInComment(source, chunks[k].start) ? S_COMMENT : S_START;
+        if (pthread_create(&threads[k], NULL, lexChunkWorker, &chunks[k]) != 0)
+        {
+            printf("Error: Could not start lexer thread\n");
+            exit(1);
+        }
+    }
+
+    for (int k = 0; k < chunkCount; k++)
+    {
+        LexChunk *chunk = &chunks[k];
+        pthread_join(threads[k], NULL);
+
+        int keep = 0;
+        int inStep = truth.state == chunk->guess;
+        if (!inStep)
+        {
+            // repair: rescan up to each speculative token start until in step
+            unsigned int at = chunk->start;
+            for (;;)
+            {
+                unsigned int next = keep < chunk->tokenCount ? chunk->tokens[keep].offset : chunk->end;
+                if (next > at)
+                    scanChunk(&truth, source + at, next - at);
+                at = next;
+                if (keep == chunk->tokenCount)
+                    break;
+
+                // a lexeme that the byte at next cannot continue is complete
+                if (isLexemeState(truth.state) && transitions[truth.state][charClass[(unsigned char)source[next]]] == S_ACCEPT)
+                {
+                    addToken(truth.state, truth.carry, truth.carryLength, truth.lexemeOffset);
+                    truth.state = S_START;
+                    truth.carryLength = 0;
+                }
+                if (truth.state == S_START)
+                {
+                    inStep = 1;
+                    break;
+                }
+                keep++;
+            }
+        }
+
+        if (inStep)
+        {
+            // in step, the speculative end state is the true one
+            truth.state = chunk->scanner.state;
+            truth.offset = chunk->end;
+            truth.carryLength = 0;
+            if (isLexemeState(truth.state))
+            {
+                truth.lexemeOffset = chunk->scanner.lexemeOffset;
+                carryLexeme(&truth, chunk->scanner.carry, chunk->scanner.carryLength);
+            }
+        }
+        appendChunkTokens(chunk, keep);
+
+        free(chunk->scanner.carry);
+        free(chunk->tokens);
+        free(chunk->names);
+        free(chunk->namePool);
+        free(chunk->nameBuckets);
+    }
+
+    finishScanner(&truth);
+    free(truth.carry);
+    free(chunks);
+    free(threads);
+}
+
+#ifndef SOURCE_CHUNK_SIZE
+#define SOURCE_CHUNK_SIZE 65536
+#endif
+
+// program text: regular files are mapped and lexed in place, pipes and
+// stdin ("-") are read SOURCE_CHUNK_SIZE bytes at a time
+typedef struct
+{
+    int fd;
+    char *data; // whole mapped file, NULL when streaming
+    size_t length;
+} SourceFile;
+
+void openSource(SourceFile *file, const char *filename)
+{
+    file->fd = strcmp(filename, "-") == 0 ? 0 : open(filename, O_RDONLY);
+    file->data = NULL;
+    file->length = 0;
+    if (file->fd < 0)
+    {
+        printf("Error: Could not open file\n");
+        exit(1);
+    }
+
+    struct stat info;
+    if (fstat(file->fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        file->length = info.st_size;
+        if (file->length == 0)
+        {
+            file->data = "";
+            return;
+        }
+        file->data = mmap(NULL, file->length, PROT_READ, MAP_PRIVATE, file->fd, 0);
+        if (file->data == MAP_FAILED)
+        {
+            // fall back to streaming, e.g. on filesystems without mmap
+            file->data = NULL;
+            file->length = 0;
+        }
+        else
+            madvise(file->data, file->length, MADV_SEQUENTIAL);
+    }
+}
+
+// next chunk of a streamed source, 0 at the end of the input
+int readSource(SourceFile *file, char *buffer, int size)
+{
+    int n;
+    do
+        n = read(file->fd, buffer, size);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+    {
+        printf("Error: Could not read file\n");
+        exit(1);
+    }
+    return n;
+}
+
+void closeSource(SourceFile *file)
+{
+    if (file->data != NULL && file->length > 0)
+        munmap(file->data, file->length);
+    if (file->fd > 0)
+        close(file->fd);
+}
+
+// tokenize a whole source file into tokens[]
+void lexSource(SourceFile *file)
+{
+    if (file->data != NULL)
+    {
+        tokenize(file->data, file->length);
+        return;
+    }
+
+    Scanner scanner = {0};
+    char *chunk = malloc(SOURCE_CHUNK_SIZE);
+    int n;
+    initScanner(&scanner);
+    while ((n = readSource(file, chunk, SOURCE_CHUNK_SIZE)) > 0)
+        scanChunk(&scanner, chunk, n);
+    finishScanner(&scanner);
+    free(scanner.carry);
+    free(chunk);
+}
+
+// length of the lexeme behind a token, source is the buffer it was scanned from
+int tokenLength(Token token, const char *source, int sourceLength)
+{
+    switch (token.type)
+    {
+    case identsym:
+    case LONG_NAME:
+    case LONG_NUMBER:
+    case INVALID_SYMBOL:
+        return nameLength(token.val);
+    case becomessym:
+    case leqsym:
+    case geqsym:
+    case neqsym:
+        return 2;
+    default:
+    {
+        // numbers and keywords are runs of digits or letters, symbols are single characters
+        int cls = charClass[(unsigned char)source[token.offset]];
+        if (cls != C_DIGIT && cls != C_LETTER)
+            return 1;
+        int n = 1;
+        while ((int)token.offset + n < sourceLength && charClass[(unsigned char)source[token.offset + n]] == cls)
+            n++;
+        return n;
+    }
+    }
+}
+
+// scratch token array for relex(), swapped in for tokens[] while rescanning
+_Thread_local Token *relexTokens = NULL;
+_Thread_local int relexCapacity = 0;
+
+// incremental re-lexing after an edit: tokens[] holds the tokens of a buffer
+// that since had the deletedLength bytes at offset replaced by insertedLength
+// new ones, source is the buffer after the edit. tokens ending before the
+// edit are kept and scanning restarts at the end of the last of them, where
+// the scanner is always in the start state. it goes on past the edit until it
+// is in the start state at the start of an old token, from there the old
+// tokens are kept with their offsets moved. edits that open or close a
+// comment just keep it scanning until that is the case. returns the number
+// of bytes rescanned
+int relex(const char *source, int length, unsigned int offset, int deletedLength, int insertedLength)
+{
+    int delta = insertedLength - deletedLength;
+    unsigned int oldEnd = offset + deletedLength;
+
+    // first token starting at or after the edit, and the first one after it
+    int lo = 0, hi = tokenCount;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (tokens[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int keep = lo;
+    if (keep > 0 && tokens[keep - 1].offset + tokenLength(tokens[keep - 1], source, length) >= offset)
+        keep--;
+    unsigned int restart = keep > 0 ? tokens[keep - 1].offset + tokenLength(tokens[keep - 1], source, length) : 0;
+    int tail = lo;
+    while (tail < tokenCount && tokens[tail].offset < oldEnd)
+        tail++;
+
+    // rescan into the scratch array
+    Token *old = tokens;
+    int oldCount = tokenCount, oldCapacity = tokenCapacity;
+    tokens = relexTokens;
+    tokenCount = 0;
+    tokenCapacity = relexCapacity;
+
+    Scanner scanner = {0};
+    initScanner(&scanner);
+    scanner.offset = restart;
+    unsigned int at = restart;
+    int j = tail;
+    for (;;)
+    {
+        unsigned int next = j < oldCount ? old[j].offset + delta : (unsigned int)length;
+        if (next > at)
+            scanChunk(&scanner, source + at, next - at);
+        at = next;
+        if (j == oldCount)
+        {
+            finishScanner(&scanner);
+            break;
+        }
+
+        // a lexeme that the byte at next cannot continue is complete
+        if (isLexemeState(scanner.state) && transitions[scanner.state][charClass[(unsigned char)source[next]]] == S_ACCEPT)
+        {
+            addToken(scanner.state, scanner.carry, scanner.carryLength, scanner.lexemeOffset);
+            scanner.state = S_START;
+            scanner.carryLength = 0;
+        }
+        if (scanner.state == S_START)
+            break;
+        j++;
+    }
+    free(scanner.carry);
+
+    Token *fresh = tokens;
+    int freshCount = tokenCount;
+    relexTokens = tokens;
+    relexCapacity = tokenCapacity;
+    tokens = old;
+    tokenCount = oldCount;
+    tokenCapacity = oldCapacity;
+
+    // splice: old tokens keep..j are replaced by the fresh ones
+    int newCount = keep + freshCount + (oldCount - j);
+    tokens = growArray(tokens, &tokenCapacity, newCount + 1, sizeof(Token));
+    memmove(tokens + keep + freshCount, tokens + j, (oldCount - j) * sizeof(Token));
+    if (delta != 0)
+    {
+        for (int i = keep + freshCount; i < newCount; i++)
+            tokens[i].offset += delta;
+    }
+    memcpy(tokens + keep, fresh, freshCount * sizeof(Token));
+    tokenCount = newCount;
+    tokens[tokenCount].offset = length;
+    tokens[tokenCount].type = 0;
+    tokens[tokenCount].val = 0;
+    return at - restart;
+}
+
+// pull interface for the parser: tokens are scanned a chunk of source at a
+// time as they are asked for, so only the tokens of the current chunk are
+// held and code is emitted before the rest of the file has been read
+SourceFile *streamFile;
+Scanner streamScanner;
+char *streamChunk;    // read buffer when the source is not mapped
+size_t streamOffset;  // next byte of a mapped source
+int streamPos;        // next unread token in tokens[]
+int streamEnd;        // input exhausted, tokens[tokenCount] is the sentinel
+
+void openTokenStream(SourceFile *file)
+{
+    streamFile = file;
+    streamOffset = 0;
+    streamPos = 0;
+    streamEnd = 0;
+    tokenCount = 0;
+    initScanner(&streamScanner);
+    if (file->data == NULL)
+        streamChunk = malloc(SOURCE_CHUNK_SIZE);
+}
+
+void closeTokenStream()
+{
+    free(streamScanner.carry);
+    free(streamChunk);
+    streamScanner.carry = NULL;
+    streamScanner.carryCapacity = 0;
+    streamChunk = NULL;
+}
+
+void printLexicalError(int type)
+{
+    if (type == LONG_NAME)
+        printf("Error: Name is too long\n");
+    else if (type == LONG_NUMBER)
+        printf("Error: Number is too long\n");
+    else if (type == INVALID_SYMBOL)
+        printf("Error: Invalid symbol\n");
+}
+
+// lexical errors stay in the token stream, they are reported as the chunk
+// holding them is scanned
+void printLexicalErrors()
+{
+    for (int i = 0; i < tokenCount; i++)
+        printLexicalError(tokens[i].type);
+}
+
+// scan chunks until there is an unread token or the input ends
+void fillTokens()
+{
+    while (streamPos >= tokenCount && !streamEnd)
+    {
+        int n;
+        tokenCount = 0;
+        streamPos = 0;
+        if (streamFile->data != NULL)
+        {
+            size_t left = streamFile->length - streamOffset;
+            n = left < SOURCE_CHUNK_SIZE ? (int)left : SOURCE_CHUNK_SIZE;
+            if (n > 0)
+                scanChunk(&streamScanner, streamFile->data + streamOffset, n);
+            streamOffset += n;
+        }
+        else
+        {
+            n = readSource(streamFile, streamChunk, SOURCE_CHUNK_SIZE);
+            if (n > 0)
+                scanChunk(&streamScanner, streamChunk, n);
+        }
+        if (n == 0)
+        {
+            finishScanner(&streamScanner);
+            streamEnd = 1;
+        }
+        printLexicalErrors();
+    }
+}
+
+// binary token file, written by "lexer -o": a header, the string table of
+// interned names in id order, each '\0' terminated and padded to 4 bytes,
+// then one fixed width record per token. it is mapped and read in place by
+// the same build that wrote it, numbers are in the writer's byte order
+#define TOKEN_FILE_MAGIC "PL0T"
+#define TOKEN_FILE_VERSION 2
+
+typedef struct
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int tokenCount;      // records, there is no sentinel record
+    unsigned int nameCount;
+    unsigned int stringTableSize; // bytes including padding
+    unsigned int sourceLength;    // records lie within it
+    unsigned int reserved;
+} TokenFileHeader;
+
+typedef struct
+{
+    unsigned int offset;   // byte offset of the lexeme in the source
+    unsigned int length;   // lexeme length in bytes
+    unsigned int type : 8; // as in Token
+    unsigned int val : 24;
+} TokenRecord;
+
+// write tokens[] and the name table for a source, 0 on failure
+int writeTokenFile(const char *filename, const char *source, int length)
+{
+    FILE *out = fopen(filename, "wb");
+    if (out == NULL)
+        return 0;
+
+    TokenFileHeader header = {{'P', 'L', '0', 'T'}, TOKEN_FILE_VERSION, 0, 0, 0, 0, 0};
+    header.tokenCount = tokenCount;
+    header.nameCount = nameCount;
+    header.stringTableSize = (namePoolSize + 3) & ~3;
+    header.sourceLength = length;
+    fwrite(&header, sizeof(header), 1, out);
+
+    char padding[4] = {0};
+    fwrite(namePool, 1, namePoolSize, out);
+    fwrite(padding, 1, header.stringTableSize - namePoolSize, out);
+
+    for (int i = 0; i < tokenCount; i++)
+    {
+        TokenRecord record = {tokens[i].offset, tokenLength(tokens[i], source, length), tokens[i].type, tokens[i].val};
+        fwrite(&record, sizeof(record), 1, out);
+    }
+    return fclose(out) == 0;
+}
+
+TokenRecord *streamRecords = NULL; // mapped token file records, if any
+int streamRecordCount = 0;
+
+// read the token stream from a mapped token file instead of scanning,
+// 0 when the file is not one. names are interned again in id order so
+// they keep their ids. every field is checked before it is used, the
+// file may be damaged or out of date with this build
+int openTokenFile(SourceFile *file)
+{
+    if (file->data == NULL || file->length < sizeof(TokenFileHeader) || memcmp(file->data, TOKEN_FILE_MAGIC, 4) != 0)
+        return 0;
+
+    TokenFileHeader *header = (TokenFileHeader *)file->data;
+    const char *table = file->data + sizeof(TokenFileHeader);
+    TokenRecord *records = (TokenRecord *)(table + header->stringTableSize);
+    int bad = header->version != TOKEN_FILE_VERSION || header->stringTableSize % 4 != 0 ||
+              sizeof(TokenFileHeader) + header->stringTableSize + (size_t)header->tokenCount * sizeof(TokenRecord) > file->length;
+
+    // each name ends inside the string table and is new, so its id is kept
+    const char *name = table;
+    for (unsigned int i = 0; !bad && i < header->nameCount; i++)
+    {
+        const char *end = memchr(name, '\0', table + header->stringTableSize - name);
+        if (end == NULL || internName(name, end - name) != (int)i + 1)
+            bad = 1;
+        else
+            name = end + 1;
+    }
+
+    for (unsigned int i = 0; !bad && i < header->tokenCount; i++)
+    {
+        TokenRecord record = records[i];
+        int named = record.type == identsym || record.type >= LONG_NAME;
+        if (!((record.type >= identsym && record.type <= oddsym) || (record.type >= LONG_NAME && record.type <= INVALID_SYMBOL)) ||
+            (named && (record.val == 0 || record.val > header->nameCount)) ||
+            (size_t)record.offset + record.length > header->sourceLength)
+            bad = 1;
+    }
+
+    if (bad)
+    {
+        printf("Error: Bad token file\n");
+        exit(1);
+    }
+
+    streamRecords = records;
+    streamRecordCount = header->tokenCount;
+    streamPos = 0;
+    for (int i = 0; i < streamRecordCount; i++)
+        printLexicalError(streamRecords[i].type);
+    return 1;
+}
+
+// token i of the mapped file, the type 0 sentinel past the end
+Token recordToken(int i)
+{
+    Token token = {0, 0, 0};
+    if (i < streamRecordCount)
+    {
+        token.offset = streamRecords[i].offset;
+        token.type = streamRecords[i].type;
+        token.val = streamRecords[i].val;
+    }
+    return token;
+}
+
+// the next token without consuming it, the type 0 sentinel at the end
+Token peek_token()
+{
+    if (streamRecords != NULL)
+        return recordToken(streamPos);
+    fillTokens();
+    return tokens[streamPos];
+}
+
+// consume and return the next token, the sentinel is never consumed
+Token next_token()
+{
+    if (streamRecords != NULL)
+    {
+        Token token = recordToken(streamPos);
+        if (streamPos < streamRecordCount)
+            streamPos++;
+        return token;
+    }
+    fillTokens();
+    Token token = tokens[streamPos];
+    if (streamPos < tokenCount)
+        streamPos++;
+    return token;
+}
+
+#endif
@@ -0,0 +1,165 @@
+// mkkeywords - generates keywords.h, the perfect hash used by lexer.h to
+// resolve reserved words and the symbol table for one and two character
+// operators
+//
+// after changing the tables below regenerate with
+//
+//     gcc mkkeywords.c -o mkkeywords && ./mkkeywords > keywords.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    char *text;
+    char *type; // token_type enumerator in lexer.h
+} Entry;
+
+Entry reserved_words[] = {
+    {"const", "constsym"},
+    {"var", "varsym"},
+    {"procedure", "procsym"},
+    {"call", "callsym"},
+    {"begin", "beginsym"},
+    {"end", "endsym"},
+    {"if", "ifsym"},
+    {"fi", "fisym"},
+    {"then", "thensym"},
+    {"else", "elsesym"},
+    {"while", "whilesym"},
+    {"do", "dosym"},
+    {"read", "readsym"},
+    {"write", "writesym"},
+    {"odd", "oddsym"}};
+
+// two character symbols all end in '=' and are keyed by their first character
+Entry symbols[] = {
+    {"+", "plussym"},
+    {"-", "minussym"},
+    {"*", "multsym"},
+    {"/", "slashsym"},
+    {"(", "lparentsym"},
+    {")", "rparentsym"},
+    {"=", "eqsym"},
+    {",", "commasym"},
+    {".", "periodsym"},
+    {"<", "lessym"},
+    {">", "gtrsym"},
+    {";", "semicolonsym"},
+    {":=", "becomessym"},
+    {"<=", "leqsym"},
+    {">=", "geqsym"},
+    {"!=", "neqsym"}};
+
+#define WORD_COUNT (int)(sizeof(reserved_words) / sizeof(reserved_words[0]))
+#define SYMBOL_COUNT (int)(sizeof(symbols) / sizeof(symbols[0]))
+
+// must match keywordHash() as written out below, all words have at least two characters
+unsigned int hash(const char *text, int length, int a, int b, int size)
+{
+    return ((unsigned char)text[0] * a + (unsigned char)text[1] * b + length) & (size - 1);
+}
+
+int main()
+{
+    int best = 0, bestA = 0, bestB = 0;
+
+    // smallest power of two table, then smallest multipliers, without collisions
+    for (int size = 16; size <= 1024 && !best; size *= 2)
+    {
+        for (int a = 1; a < 256 && !best; a++)
+        {
+            for (int b = 0; b < 256 && !best; b++)
+            {
+                char used[1024] = {0};
+                int ok = 1;
+                for (int i = 0; i < WORD_COUNT && ok; i++)
+                {
+                    unsigned int h = hash(reserved_words[i].text, strlen(reserved_words[i].text), a, b, size);
+                    ok = !used[h];
+                    used[h] = 1;
+                }
+                if (ok)
+                {
+                    best = size;
+                    bestA = a;
+                    bestB = b;
+                }
+            }
+        }
+    }
+
+    if (!best)
+    {
+        fprintf(stderr, "mkkeywords: no perfect hash found\n");
+        return 1;
+    }
+
+    int minLength = 1000, maxLength = 0;
+    for (int i = 0; i < WORD_COUNT; i++)
+    {
+        int length = strlen(reserved_words[i].text);
+        if (length < minLength)
+            minLength = length;
+        if (length > maxLength)
+            maxLength = length;
+    }
+    if (minLength < 2)
+    {
+        fprintf(stderr, "mkkeywords: reserved words need at least two characters\n");
+        return 1;
+    }
+
+    char *slot[1024] = {0};
+    char *slotType[1024] = {0};
+    for (int i = 0; i < WORD_COUNT; i++)
+    {
+        unsigned int h = hash(reserved_words[i].text, strlen(reserved_words[i].text), bestA, bestB, best);
+        slot[h] = reserved_words[i].text;
+        slotType[h] = reserved_words[i].type;
+    }
+
+    printf("// keywords.h - generated by mkkeywords.c, do not edit\n\n");
+    printf("#define KEYWORD_TABLE_SIZE %d\n", best);
+    printf("#define KEYWORD_MIN_LENGTH %d\n", minLength);
+    printf("#define KEYWORD_MAX_LENGTH %d\n\n", maxLength);
+
+    printf("// length must be at least KEYWORD_MIN_LENGTH\n");
+    printf("unsigned int keywordHash(const char *text, int length)\n{\n");
+    printf("    return ((unsigned char)text[0] * %d + (unsigned char)text[1] * %d + length) & (KEYWORD_TABLE_SIZE - 1);\n", bestA, bestB);
+    printf("}\n\n");
+
+    printf("struct\n{\n    char *text;\n    int length;\n    int type;\n} keywordTable[KEYWORD_TABLE_SIZE] = {\n");
+    for (int h = 0; h < best; h++)
+    {
+        if (slot[h])
+            printf("    [%d] = {\"%s\", %d, %s},\n", h, slot[h], (int)strlen(slot[h]), slotType[h]);
+    }
+    printf("};\n\n");
+
+    printf("// one character symbols by character, two character ones by their first\n");
+    printf("const unsigned char oneCharSymbols[256] = {\n");
+    for (int i = 0; i < SYMBOL_COUNT; i++)
+    {
+        if (strlen(symbols[i].text) == 1)
+            printf("    ['%s'] = %s,\n", symbols[i].text, symbols[i].type);
+    }
+    printf("};\n\n");
+
+    printf("const unsigned char twoCharSymbols[256] = {\n");
+    for (int i = 0; i < SYMBOL_COUNT; i++)
+    {
+        if (strlen(symbols[i].text) == 2)
+        {
+            if (symbols[i].text[1] != '=')
+            {
+                fprintf(stderr, "mkkeywords: %s does not end in '='\n", symbols[i].text);
+                return 1;
+            }
+            printf("    ['%c'] = %s,\n", symbols[i].text[0], symbols[i].type);
+        }
+    }
+    printf("};\n");
+    return 0;
+}
@@ -1,131 +1,205 @@
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
-#define SYMBOL_TABLE_SIZE 500
+#include "lexer.h"
+
+// compiler arena: code, symbols and everything else that lives for one
+// compilation is carved front to back out of a few large blocks, there is
+// no per object malloc and resetArena() frees it all at once
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+ArenaBlock *arenaFirst = NULL;
+ArenaBlock *arenaCurrent = NULL;
+void *arenaLast = NULL; // latest allocation, the one that can grow in place
+
+void *arenaAlloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    while (arenaCurrent == NULL || arenaCurrent->used + size > arenaCurrent->size)
+    {
+        // blocks kept by an earlier reset are used again in order
+        if (arenaCurrent != NULL && arenaCurrent->next != NULL)
+        {
+            arenaCurrent = arenaCurrent->next;
+            arenaCurrent->used = 0;
+            continue;
+        }
+        size_t blockSize = ARENA_BLOCK_SIZE;
+        if (arenaCurrent != NULL && arenaCurrent->size * 2 > blockSize)
+            blockSize = arenaCurrent->size * 2;
+        if (blockSize < size)
+            blockSize = size;
+        ArenaBlock *block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL)
+        {
+            printf("Error: Out of memory\n");
+            exit(1);
+        }
+        block->next = NULL;
+        block->size = blockSize;
+        block->used = 0;
+        if (arenaCurrent != NULL)
+            arenaCurrent->next = block;
+        else
+            arenaFirst = block;
+        arenaCurrent = block;
+    }
+    arenaLast = arenaCurrent->data + arenaCurrent->used;
+    arenaCurrent->used += size;
+    return arenaLast;
+}
+
+// growArray() for arena memory: doubles the capacity, in place when the
+// array is the latest allocation and its block has room, otherwise by
+// copying into a new allocation, either way amortized O(1) per append
+void *arenaGrow(void *array, int *capacity, int needed, int elementSize)
+{
+    if (needed <= *capacity)
+        return array;
+    int newCapacity = *capacity ? *capacity : 1024;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+
+    size_t oldSize = ((size_t)*capacity * elementSize + 15) & ~(size_t)15;
+    size_t newSize = ((size_t)newCapacity * elementSize + 15) & ~(size_t)15;
+    if (array != NULL && array == arenaLast && arenaCurrent->used - oldSize + newSize <= arenaCurrent->size)
+        arenaCurrent->used += newSize - oldSize;
+    else
+    {
+        void *grown = arenaAlloc(newSize);
+        if (array != NULL)
+            memcpy(grown, array, (size_t)*capacity * elementSize);
+        array = grown;
+    }
+    *capacity = newCapacity;
+    return array;
+}
+
+// free everything allocated for a compilation, the blocks are kept for the next one
+void resetArena()
+{
+    for (ArenaBlock *block = arenaFirst; block != NULL; block = block->next)
+        block->used = 0;
+    arenaCurrent = arenaFirst;
+    arenaLast = NULL;
+}
+
+// syntax tree: the parser builds it in the arena, fold() simplifies it and
+// generate() lowers it to code
+enum
+{
+    NODE_NUMBER, // value
+    NODE_VAR,    // value: symbol, a constant until folded
+    NODE_NEG,    // left
+    NODE_ODD,    // left
+    NODE_BINARY, // op: OPR number, left and right operands
+    NODE_ASSIGN, // value: symbol, left: expression
+    NODE_CALL,   // value: symbol
+    NODE_BEGIN,  // left: first statement, chained through next
+    NODE_IF,     // left: condition, right: then, third: else or NULL
+    NODE_WHILE,  // left: condition, right: body
+    NODE_READ,   // value: symbol
+    NODE_WRITE,  // left: expression
+    NODE_BLOCK   // value: procedure symbol or -1, op: variables, left: procedures, right: body
+};
+
+// OPR numbers, M of opcode 2
+enum
+{
+    OPR_RTN,
+    OPR_ADD,
+    OPR_SUB,
+    OPR_MUL,
+    OPR_DIV,
+    OPR_EQL,
+    OPR_NEQ,
+    OPR_LSS,
+    OPR_LEQ,
+    OPR_GTR,
+    OPR_GEQ,
+    OPR_ODD,
+    OPR_SHL, // shift left by the top of stack
+    OPR_SHR, // divide by 2 to the power of the top of stack, toward zero like DIV
+    OPR_AND
+};
+
+typedef struct Node
+{
+    int kind;
+    int op;
+    int value;
+    struct Node *left;
+    struct Node *right;
+    struct Node *third;
+    struct Node *next;
+} Node;
+
+Node *newNode(int kind)
+{
+    Node *node = arenaAlloc(sizeof(Node));
+    memset(node, 0, sizeof(Node));
+    node->kind = kind;
+    return node;
+}
+
+Node *newBinary(int op, Node *left, Node *right)
+{
+    Node *node = newNode(NODE_BINARY);
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    return node;
+}
 
 // prototypes
-void readFile(char *filename);
-void tokenize();
-void program();
-void block();
+Node *program();
+Node *block(int procIdx);
 void constDeclaration();
 int varDeclaration();
-void statement();
-void condition();
-void expression();
-void term();
-void factor();
+Node *procedureDeclaration();
+Node *statement();
+Node *condition();
+Node *expression();
+Node *term();
+Node *factor();
+Node *fold(Node *node);
+void generate(Node *node);
 void printError(int i);
-int symbolTableCheck(char *name);
-void addSymbol(int kind, char *name, int val, int level, int addr);
+int symbolTableCheck(int name);
+int declaredInScope(int name);
+void addSymbol(int kind, int name, int val, int level, int addr);
+void popScope(int start);
 void emit(int OP, int L, int M);
 
-typedef enum
-{
-    skipsym = 1,
-    identsym,
-    numbersym,
-    plussym,
-    minussym,
-    multsym,
-    slashsym,
-    fisym,
-    eqsym,
-    neqsym,
-    lessym,
-    leqsym,
-    gtrsym,
-    geqsym,
-    lparentsym,
-    rparentsym,
-    commasym,
-    semicolonsym,
-    periodsym,
-    becomessym,
-    beginsym,
-    endsym,
-    ifsym,
-    thensym,
-    whilesym,
-    dosym,
-    callsym,
-    constsym,
-    varsym,
-    procsym,
-    writesym,
-    readsym,
-    elsesym,
-    oddsym, // modified
-} token_type;
-
-char *reserved_words[] = {
-    "const",
-    "var",
-    "procedure",
-    "call",
-    "begin",
-    "end",
-    "if",
-    "fi",
-    "then",
-    "else",
-    "while",
-    "do",
-    "read",
-    "write"};
-
-char *symbols[] = {
-    "+",
-    "-",
-    "*",
-    "/",
-    "(",
-    ")",
-    ":=",
-    "<=",
-    ">=",
-    ",",
-    ".",
-    "<",
-    ">",
-    ";",
-    ":",
-    "!=",
-    "="};
-
-char source[5012];
-int tokenCount = 0;
-
 typedef struct
 {
     int kind;      // const = 1, var = 2, proc = 3
-    char name[10]; // name up to 11 chars
+    int name;      // interned name id
     int val;       // number (ASCII value)
     int level;     // L level
     int addr;      // M address
     int mark;      // to indicate unavailable or deleted
+    int shadow;    // symbol of the same name this one hides, -1 if none
 } symbol;
 
-symbol symbol_table[SYMBOL_TABLE_SIZE];
-
-typedef enum
-{
-    KEYWORD,
-    IDENTIFIER,
-    NUMBER,
-    OPERATOR,
-    SYMBOL
-} TokenType;
-
-typedef struct
-{
-    TokenType type;
-    char value[100];
-} Token;
+symbol *symbol_table = NULL;
+int symbolTableCapacity = 0;
 
-Token tokens[1024];
+// innermost visible symbol for each interned name id, -1 if none. name ids
+// are already unique per spelling, so this is the whole hash lookup
+int *visibleSymbol = NULL;
+int visibleCapacity = 0;
 
 typedef struct
 {
@@ -134,235 +208,43 @@ typedef struct
     int M;
 } INS;
 
-INS code[1024];
+INS *code = NULL;
+int codeCapacity = 0;
 
 char *opcodes[10] = {"LIT", "OPR", "LOD", "STO", "CAL",
                      "INC", "JMP", "JPC", "SYS", "ERR"};
 char *syscodes[3] = {"SOU", "SIN", "EOP"};
-char *operations[12] = {"RTN", "ADD", "SUB", "MUL", "DIV", "EQL", "NEQ", "LSS", "LEQ", "GTR", "GEQ", "ODD"};
+char *operations[15] = {"RTN", "ADD", "SUB", "MUL", "DIV", "EQL", "NEQ", "LSS", "LEQ", "GTR", "GEQ", "ODD", "SHL", "SHR", "AND"};
 
-int currentToken = 0;
-int numVars = 0;
 int symbolTableIndex = 0;
 int currentCodeIndex = 0;
 
 int level = 0;
 
+// forget the compiled program and its symbols, ready for the next compilation
+void resetCompiler()
+{
+    resetArena();
+    code = NULL;
+    codeCapacity = 0;
+    currentCodeIndex = 0;
+    symbol_table = NULL;
+    symbolTableCapacity = 0;
+    symbolTableIndex = 0;
+    visibleSymbol = NULL;
+    visibleCapacity = 0;
+    level = 0;
+}
+
 void emit(int OP, int L, int M)
 {
+    code = arenaGrow(code, &codeCapacity, currentCodeIndex + 1, sizeof(INS));
     code[currentCodeIndex].OP = OP;
     code[currentCodeIndex].L = L;
     code[currentCodeIndex].M = M;
     currentCodeIndex++;
 }
 
-int is_letter(char c)
-{
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
-}
-
-int isSymbol(char c)
-{
-    return !isalnum((unsigned char)c) && !isspace((unsigned char)c) && c != '_' && c != '\0' && c != '\n' && c != '\r' && c != '\t';
-}
-
-int is_digit(char c)
-{
-    return c >= '0' && c <= '9';
-}
-
-int starts_with(char *str, char *prefix)
-{
-    return strncmp(str, prefix, strlen(prefix)) == 0;
-}
-
-void tokenize()
-{
-    int i = 0;
-
-    while (source[i] != '\0')
-    {
-        // whitespace
-        if (source[i] == ' ' || source[i] == '\t' || source[i] == '\n' || source[i] == '\r' || source[i] == '\0')
-        {
-            i++;
-            continue;
-        }
-
-        // reserved words
-        for (int j = 0; j < 14; j++)
-        {
-            if (starts_with(&source[i], reserved_words[j]))
-            {
-                strcpy(tokens[tokenCount].value, reserved_words[j]);
-                tokens[tokenCount].type = KEYWORD;
-                tokenCount++;
-                i += strlen(reserved_words[j]);
-                continue;
-            }
-        }
-
-        // symbols
-        for (int j = 0; j < 17; j++)
-        {
-            if (starts_with(&source[i], symbols[j]))
-            {
-                strcpy(tokens[tokenCount].value, symbols[j]);
-                tokens[tokenCount].type = SYMBOL;
-                tokenCount++;
-                i += strlen(symbols[j]);
-                continue;
-            }
-        }
-
-        // identifier
-        if (is_letter(source[i]))
-        {
-            int j = 0;
-            while (is_letter(source[i]) || is_digit(source[i]))
-            {
-                tokens[tokenCount].value[j] = source[i];
-                i++;
-                j++;
-            }
-            tokens[tokenCount].value[j] = '\0';
-            tokens[tokenCount].type = IDENTIFIER;
-            tokenCount++;
-            continue;
-        }
-
-        // number
-        if (is_digit(source[i]))
-        {
-            int j = 0;
-            while (is_digit(source[i]))
-            {
-                tokens[tokenCount].value[j] = source[i];
-                i++;
-                j++;
-            }
-            tokens[tokenCount].value[j] = '\0';
-            tokens[tokenCount].type = NUMBER;
-            tokenCount++;
-            continue;
-        }
-
-        // comment
-        if (source[i] == '/')
-        {
-            if (source[i + 1] == '*')
-            {
-                i += 2;
-                while (source[i] != '*' && source[i + 1] != '/')
-                    i++;
-                i += 2;
-                continue;
-            }
-        }
-
-        // single character symbols
-        if (isSymbol(source[i]))
-        {
-            tokens[tokenCount].value[0] = source[i];
-            tokens[tokenCount].value[1] = '\0';
-            tokens[tokenCount].type = SYMBOL;
-            tokenCount++;
-            i++;
-            continue;
-        }
-
-        i++;
-    }
-}
-
-void readFile(char *filename)
-{
-    FILE *file = fopen(filename, "r");
-    if (file == NULL)
-    {
-        printf("Error: Could not open file\n");
-        exit(1);
-    }
-    char c;
-    int i = 0;
-    while ((c = fgetc(file)) != EOF)
-        source[i++] = c;
-    source[i] = '\0';
-    fclose(file);
-}
-
-int getKeywordValue(char *keyword)
-{
-    if (strcmp(keyword, "const") == 0)
-        return constsym;
-    else if (strcmp(keyword, "var") == 0)
-        return varsym;
-    else if (strcmp(keyword, "procedure") == 0)
-        return procsym;
-    else if (strcmp(keyword, "call") == 0)
-        return callsym;
-    else if (strcmp(keyword, "begin") == 0)
-        return beginsym;
-    else if (strcmp(keyword, "end") == 0)
-        return endsym;
-    else if (strcmp(keyword, "if") == 0)
-        return ifsym;
-    else if (strcmp(keyword, "fi") == 0)
-        return thensym;
-    else if (strcmp(keyword, "then") == 0)
-        return thensym;
-    else if (strcmp(keyword, "else") == 0)
-        return elsesym;
-    else if (strcmp(keyword, "while") == 0)
-        return whilesym;
-    else if (strcmp(keyword, "do") == 0)
-        return dosym;
-    else if (strcmp(keyword, "read") == 0)
-        return readsym;
-    else if (strcmp(keyword, "write") == 0)
-        return writesym;
-    else
-        return -1;
-}
-
-int getSymbolValue(char *symbol)
-{
-    if (strcmp(symbol, "+") == 0)
-        return plussym;
-    else if (strcmp(symbol, "-") == 0)
-        return minussym;
-    else if (strcmp(symbol, "*") == 0)
-        return multsym;
-    else if (strcmp(symbol, "/") == 0)
-        return slashsym;
-    else if (strcmp(symbol, "(") == 0)
-        return lparentsym;
-    else if (strcmp(symbol, ")") == 0)
-        return rparentsym;
-    else if (strcmp(symbol, "=") == 0)
-        return eqsym;
-    else if (strcmp(symbol, ",") == 0)
-        return commasym;
-    else if (strcmp(symbol, ".") == 0)
-        return periodsym;
-    else if (strcmp(symbol, "<") == 0)
-        return lessym;
-    else if (strcmp(symbol, ">") == 0)
-        return gtrsym;
-    else if (strcmp(symbol, ";") == 0)
-        return semicolonsym;
-    else if (strcmp(symbol, ":=") == 0)
-        return becomessym;
-    else if (strcmp(symbol, "<=") == 0)
-        return leqsym;
-    else if (strcmp(symbol, ">=") == 0)
-        return geqsym;
-    else if (strcmp(symbol, "!=") == 0)
-        return neqsym;
-    else
-        return -1;
-}
-
 void printError(int i)
 {
     switch (i)
@@ -427,387 +309,3907 @@ void printError(int i)
         printf("Error: Arithmetic equations must contain operands, parentheses, numbers, or symbols\n");
         break;
 
+    case 15:
+        printf("Error: procedure and call keywords must be followed by identifier\n");
+        break;
+
+    case 16:
+        printf("Error: Procedure declarations must be followed by a semicolon\n");
+        break;
+
+    case 17:
+        printf("Error: Only procedures may be called\n");
+        break;
+
     default:
         break;
     }
+    exit(1);
 }
 
-int symbolTableCheck(char *name)
+int symbolTableCheck(int name)
 {
-    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++)
-    {
-        if (strcmp(symbol_table[i].name, name) == 0)
-            return i;
-    }
-    return -1;
+    return name < visibleCapacity ? visibleSymbol[name] : -1;
+}
+
+// whether name is already declared in the innermost scope, outer ones may be shadowed
+int declaredInScope(int name)
+{
+    int symIdx = symbolTableCheck(name);
+    return symIdx != -1 && symbol_table[symIdx].level == level;
 }
 
-void addSymbol(int kind, char *name, int val, int level, int addr)
+void addSymbol(int kind, int name, int val, int level, int addr)
 {
+    symbol_table = arenaGrow(symbol_table, &symbolTableCapacity, symbolTableIndex + 1, sizeof(symbol));
+    if (name >= visibleCapacity)
+    {
+        int oldCapacity = visibleCapacity;
+        visibleSymbol = arenaGrow(visibleSymbol, &visibleCapacity, name + 1, sizeof(int));
+        for (int i = oldCapacity; i < visibleCapacity; i++)
+            visibleSymbol[i] = -1;
+    }
+
     symbol_table[symbolTableIndex].kind = kind;
-    strcpy(symbol_table[symbolTableIndex].name, name);
+    symbol_table[symbolTableIndex].name = name;
     symbol_table[symbolTableIndex].val = val;
     symbol_table[symbolTableIndex].level = level;
     symbol_table[symbolTableIndex].addr = addr;
-    symbol_table[symbolTableIndex].mark = 1;
+    symbol_table[symbolTableIndex].mark = 0;
+    symbol_table[symbolTableIndex].shadow = visibleSymbol[name];
+    visibleSymbol[name] = symbolTableIndex;
     symbolTableIndex++;
 }
 
-void program()
+// end of a block: its symbols become unavailable and the ones they shadowed visible again
+void popScope(int start)
+{
+    for (int i = symbolTableIndex - 1; i >= start; i--)
+    {
+        visibleSymbol[symbol_table[i].name] = symbol_table[i].shadow;
+        symbol_table[i].mark = 1;
+    }
+}
+
+Node *program()
 {
-    emit(7, 0, 3);
-    block();
-    if (strcmp(tokens[currentToken].value, ".") != 0)
+    Node *root = block(-1);
+    if (peek_token().type != periodsym)
         printError(0);
-    emit(9, 0, 3);
+    return root;
 }
 
-void block()
+// procIdx is the symbol of the procedure whose body this is, -1 for the main block
+Node *block(int procIdx)
 {
+    int scope = symbolTableIndex;
+    Node *node = newNode(NODE_BLOCK);
+    node->value = procIdx;
     constDeclaration();
-    numVars = varDeclaration();
-    emit(6, 0, 3 + numVars);
-    statement();
+    node->op = varDeclaration();
+    node->left = procedureDeclaration();
+    node->right = statement();
+    popScope(scope);
+    return node;
 }
 
 void constDeclaration()
 {
-    if (getKeywordValue(tokens[currentToken].value) == constsym)
+    if (peek_token().type == constsym)
     {
         do
         {
-            currentToken++;
-            if (tokens[currentToken].type != IDENTIFIER)
+            next_token();
+            if (peek_token().type != identsym)
                 printError(1);
-            if (symbolTableCheck(tokens[currentToken].value) != -1)
+            if (declaredInScope(peek_token().val))
                 printError(2);
-            char *name = tokens[currentToken].value;
-            currentToken++;
-            if (getSymbolValue(tokens[currentToken].value) != eqsym)
+            int name = peek_token().val;
+            next_token();
+            if (peek_token().type != eqsym)
                 printError(3);
-            currentToken++;
-            if (tokens[currentToken].type != NUMBER)
+            next_token();
+            if (peek_token().type != numbersym)
                 printError(4);
-            addSymbol(1, name, atoi(tokens[currentToken].value), 0, 0);
-            currentToken++;
-        } while (atoi(tokens[currentToken].value) == commasym);
+            addSymbol(1, name, peek_token().val, level, 0);
+            next_token();
+        } while (peek_token().type == commasym);
 
-        if (atoi(tokens[currentToken].value) != semicolonsym)
+        if (peek_token().type != semicolonsym)
             printError(5);
-        currentToken++;
+        next_token();
     }
 }
 
 int varDeclaration()
 {
-    numVars = 0;
-    if (getKeywordValue(tokens[currentToken].value) == varsym)
+    int numVars = 0;
+    if (peek_token().type == varsym)
     {
         do
         {
             numVars++;
-            currentToken++;
-            if (tokens[currentToken].type != IDENTIFIER)
+            next_token();
+            if (peek_token().type != identsym)
                 printError(1);
-            if (symbolTableCheck(tokens[currentToken].value) != -1)
+            if (declaredInScope(peek_token().val))
                 printError(2);
-            addSymbol(2, tokens[currentToken].value, 0, 0, 2 + numVars);
-            currentToken++;
-        } while (getSymbolValue(tokens[currentToken].value) == commasym);
-        if (getSymbolValue(tokens[currentToken].value) != semicolonsym)
+            addSymbol(2, peek_token().val, 0, level, 2 + numVars);
+            next_token();
+        } while (peek_token().type == commasym);
+        if (peek_token().type != semicolonsym)
             printError(5);
-        currentToken++;
+        next_token();
     }
     return numVars;
 }
 
-void statement()
+// the procedures of a block, chained through next
+Node *procedureDeclaration()
+{
+    Node *first = NULL, **last = &first;
+    while (peek_token().type == procsym)
+    {
+        next_token();
+        if (peek_token().type != identsym)
+            printError(15);
+        if (declaredInScope(peek_token().val))
+            printError(2);
+        addSymbol(3, peek_token().val, 0, level, 0);
+        int procIdx = symbolTableIndex - 1;
+        next_token();
+        if (peek_token().type != semicolonsym)
+            printError(16);
+        next_token();
+        level++;
+        *last = block(procIdx);
+        last = &(*last)->next;
+        level--;
+        if (peek_token().type != semicolonsym)
+            printError(16);
+        next_token();
+    }
+    return first;
+}
+
+// NULL for the empty statement
+Node *statement()
 {
-    if (tokens[currentToken].type == IDENTIFIER)
+    if (peek_token().type == identsym)
     {
-        int symIdx = symbolTableCheck(tokens[currentToken].value);
+        int symIdx = symbolTableCheck(peek_token().val);
         if (symIdx == -1)
             printError(6);
         if (symbol_table[symIdx].kind != 2)
             printError(7);
-        currentToken++;
-        if (getSymbolValue(tokens[currentToken].value) != becomessym)
+        next_token();
+        if (peek_token().type != becomessym)
             printError(8);
-        currentToken++;
-        expression();
-        // emit STO(M=table[symIdx].addr)
-        emit(4, 0, symbol_table[symIdx].addr);
-        return;
+        next_token();
+        Node *node = newNode(NODE_ASSIGN);
+        node->value = symIdx;
+        node->left = expression();
+        return node;
     }
-    // if (atoi(tokens[currentToken].value) == beginsym)
-    if (getKeywordValue(tokens[currentToken].value) == beginsym)
+    if (peek_token().type == beginsym)
     {
+        Node *node = newNode(NODE_BEGIN);
+        Node **last = &node->left;
         do
         {
-            currentToken++;
-            statement();
-            // } while (atoi(tokens[currentToken].value) == semicolonsym);
-        } while (getSymbolValue(tokens[currentToken].value) == semicolonsym);
-        // if (atoi(tokens[currentToken].value) != endsym)
-        if (getKeywordValue(tokens[currentToken].value) != endsym)
+            next_token();
+            Node *child = statement();
+            if (child != NULL)
+            {
+                *last = child;
+                last = &child->next;
+            }
+        } while (peek_token().type == semicolonsym);
+        if (peek_token().type != endsym)
             printError(9);
-        currentToken++;
-        return;
+        next_token();
+        return node;
     }
-    if (atoi(tokens[currentToken].value) == ifsym)
+    if (peek_token().type == ifsym)
     {
-        currentToken++;
-        condition();
-        int jpcIdx = currentCodeIndex;
-        // emit JPC
-        emit(8, 0, 0);
-        if (getKeywordValue(tokens[currentToken].value) != thensym)
+        next_token();
+        Node *node = newNode(NODE_IF);
+        node->left = condition();
+        if (peek_token().type != thensym)
             printError(10);
-        currentToken++;
-        statement();
-        code[jpcIdx].M = currentCodeIndex;
-        return;
+        next_token();
+        node->right = statement();
+        if (peek_token().type == elsesym)
+        {
+            next_token();
+            node->third = statement();
+        }
+        // fi is optional
+        if (peek_token().type == fisym)
+            next_token();
+        return node;
     }
-    if (getKeywordValue(tokens[currentToken].value) == whilesym)
+    if (peek_token().type == whilesym)
     {
-        currentToken++;
-        int loopIdx = currentCodeIndex;
-        condition();
-        if (getKeywordValue(tokens[currentToken].value) != dosym)
+        next_token();
+        Node *node = newNode(NODE_WHILE);
+        node->left = condition();
+        if (peek_token().type != dosym)
             printError(11);
-        currentToken++;
-        int jpcIdx = currentCodeIndex;
-        // emit JPC
-        emit(8, 0, 0);
-        statement();
-        // emit JMP(M=loopIdx)
-        emit(7, 0, loopIdx);
-        code[jpcIdx].M = currentCodeIndex;
-        return;
+        next_token();
+        node->right = statement();
+        return node;
     }
-    if (getKeywordValue(tokens[currentToken].value) == readsym)
+    if (peek_token().type == readsym)
     {
-        currentToken++;
-        if (tokens[currentToken].type != IDENTIFIER)
+        next_token();
+        if (peek_token().type != identsym)
             printError(1);
-        int symIdx = symbolTableCheck(tokens[currentToken].value);
+        int symIdx = symbolTableCheck(peek_token().val);
         if (symIdx == -1)
             printError(6);
         if (symbol_table[symIdx].kind != 2)
-            printError(4); // to be correct
-        currentToken++;
-        // emit READ
-        emit(9, 0, 2);
-        // emit STO(M=table[symIdx].addr)
-        emit(4, 0, symbol_table[symIdx].addr);
-        currentToken++;
-        return;
+            printError(7);
+        next_token();
+        Node *node = newNode(NODE_READ);
+        node->value = symIdx;
+        return node;
     }
-    if (getKeywordValue(tokens[currentToken].value) == writesym)
+    if (peek_token().type == callsym)
     {
-        currentToken++;
-        expression();
-        // emit WRITE
-        emit(9, 0, 1);
-        return;
+        next_token();
+        if (peek_token().type != identsym)
+            printError(15);
+        int symIdx = symbolTableCheck(peek_token().val);
+        if (symIdx == -1)
+            printError(6);
+        if (symbol_table[symIdx].kind != 3)
+            printError(17);
+        next_token();
+        Node *node = newNode(NODE_CALL);
+        node->value = symIdx;
+        return node;
     }
+    if (peek_token().type == writesym)
+    {
+        next_token();
+        Node *node = newNode(NODE_WRITE);
+        node->left = expression();
+        return node;
+    }
+    return NULL;
 }
 
-void condition()
+Node *condition()
 {
-    expression();
-    if (getSymbolValue(tokens[currentToken].value) == eqsym)
+    if (peek_token().type == oddsym)
     {
-        currentToken++;
-        expression();
-        // emit EQL
-        emit(8, 0, 8);
+        next_token();
+        Node *node = newNode(NODE_ODD);
+        node->left = expression();
+        return node;
     }
-    else if (getSymbolValue(tokens[currentToken].value) == neqsym)
+    Node *left = expression();
+    int op;
+    switch (peek_token().type)
     {
-        currentToken++;
-        expression();
-        // emit NEQ
-        emit(8, 0, 9);
+    case eqsym:
+        op = OPR_EQL;
+        break;
+    case neqsym:
+        op = OPR_NEQ;
+        break;
+    case lessym:
+        op = OPR_LSS;
+        break;
+    case leqsym:
+        op = OPR_LEQ;
+        break;
+    case gtrsym:
+        op = OPR_GTR;
+        break;
+    case geqsym:
+        op = OPR_GEQ;
+        break;
+    default:
+        printError(12);
+        return NULL;
     }
-    else if (getSymbolValue(tokens[currentToken].value) == lessym)
+    next_token();
+    return newBinary(op, left, expression());
+}
+
+Node *expression()
+{
+    Node *node;
+    if (peek_token().type == minussym)
     {
-        currentToken++;
-        expression();
-        // emit LSS
-        emit(8, 0, 7);
+        next_token();
+        node = newNode(NODE_NEG);
+        node->left = term();
     }
-    else if (getSymbolValue(tokens[currentToken].value) == leqsym)
+    else
     {
-        currentToken++;
-        expression();
-        // emit LEQ
-        emit(8, 0, 8);
+        if (peek_token().type == plussym)
+            next_token();
+        node = term();
     }
-    else if (getSymbolValue(tokens[currentToken].value) == gtrsym)
+    while (peek_token().type == plussym || peek_token().type == minussym)
     {
-        currentToken++;
-        expression();
-        // emit GTR
-        emit(8, 0, 9);
+        int op = peek_token().type == plussym ? OPR_ADD : OPR_SUB;
+        next_token();
+        node = newBinary(op, node, term());
     }
-    else if (getSymbolValue(tokens[currentToken].value) == geqsym)
+    return node;
+}
+
+Node *term()
+{
+    Node *node = factor();
+    while (peek_token().type == multsym || peek_token().type == slashsym)
     {
-        currentToken++;
-        expression();
-        // emit GEQ
-        emit(8, 0, 10);
+        int op = peek_token().type == multsym ? OPR_MUL : OPR_DIV;
+        next_token();
+        node = newBinary(op, node, factor());
     }
-    else
-        printError(12);
+    return node;
 }
 
-void expression()
+Node *factor()
 {
-    if (getSymbolValue(tokens[currentToken].value) == minussym)
+    if (peek_token().type == identsym)
     {
-        currentToken++;
-        term();
-        // emit NEG
-        emit(2, 0, 1);
-        while (getSymbolValue(tokens[currentToken].value) == plussym || getSymbolValue(tokens[currentToken].value) == minussym)
-        {
-            if (getSymbolValue(tokens[currentToken].value) == plussym)
-            {
-                currentToken++;
-                term();
-                // emit ADD
-                emit(2, 0, 2);
-            }
-            else
-            {
-                currentToken++;
-                term();
-                // emit SUB
-                emit(2, 0, 3);
-            }
-        }
+        int symIdx = symbolTableCheck(peek_token().val);
+        if (symIdx == -1)
+            printError(6);
+        if (symbol_table[symIdx].kind == 3)
+            printError(7);
+        next_token();
+        // constants stay names here, folding puts their values in
+        Node *node = newNode(NODE_VAR);
+        node->value = symIdx;
+        return node;
     }
-    else
+    if (peek_token().type == numbersym)
+    {
+        Node *node = newNode(NODE_NUMBER);
+        node->value = peek_token().val;
+        next_token();
+        return node;
+    }
+    if (peek_token().type == lparentsym)
     {
-        if (getSymbolValue(tokens[currentToken].value) == plussym)
-            currentToken++;
-        term();
-        while (getSymbolValue(tokens[currentToken].value) == plussym || getSymbolValue(tokens[currentToken].value) == minussym)
+        next_token();
+        Node *node = expression();
+        if (peek_token().type != rparentsym)
+            printError(13);
+        next_token();
+        return node;
+    }
+    printError(14);
+    return NULL;
+}
+
+// constant folding: operators on constants are evaluated as the VM would,
+// 32 bit wrapping, division truncating toward zero, except by zero which is
+// left to fail at run time. ifs and whiles on a constant condition keep only
+// the branch that runs
+int isNumber(Node *node, int value)
+{
+    return node->kind == NODE_NUMBER && node->value == value;
+}
+
+int evaluate(int op, int a, int b)
+{
+    switch (op)
+    {
+    case OPR_ADD:
+        return (int)((unsigned)a + (unsigned)b);
+    case OPR_SUB:
+        return (int)((unsigned)a - (unsigned)b);
+    case OPR_MUL:
+        return (int)((unsigned)a * (unsigned)b);
+    case OPR_DIV:
+        return b == -1 ? (int)(0u - (unsigned)a) : a / b;
+    case OPR_EQL:
+        return a == b;
+    case OPR_NEQ:
+        return a != b;
+    case OPR_LSS:
+        return a < b;
+    case OPR_LEQ:
+        return a <= b;
+    case OPR_GTR:
+        return a > b;
+    case OPR_SHL:
+        return (int)((unsigned)a << b);
+    case OPR_SHR:
+        return (a + ((a >> 31) & ((1 << b) - 1))) >> b;
+    case OPR_AND:
+        return a & b;
+    default:
+        return a >= b;
+    }
+}
+
+// k when value is 2 to the power k for k from 1 to 30, otherwise 0
+int powerOfTwo(int value)
+{
+    if (value < 2 || (value & (value - 1)) != 0)
+        return 0;
+    int k = 0;
+    while (value > 1)
+    {
+        value >>= 1;
+        k++;
+    }
+    return k;
+}
+
+Node *foldNumber(Node *node, int value)
+{
+    node->kind = NODE_NUMBER;
+    node->value = value;
+    node->left = node->right = NULL;
+    return node;
+}
+
+Node *fold(Node *node)
+{
+    if (node == NULL)
+        return NULL;
+    switch (node->kind)
+    {
+    case NODE_VAR:
+        if (symbol_table[node->value].kind == 1)
+            return foldNumber(node, symbol_table[node->value].val);
+        return node;
+    case NODE_NEG:
+        node->left = fold(node->left);
+        if (node->left->kind == NODE_NUMBER)
+            return foldNumber(node, (int)(0u - (unsigned)node->left->value));
+        return node;
+    case NODE_ODD:
+        node->left = fold(node->left);
+        if (node->left->kind == NODE_NUMBER)
+            return foldNumber(node, node->left->value % 2);
+        return node;
+    case NODE_BINARY:
+        node->left = fold(node->left);
+        node->right = fold(node->right);
+        if (node->left->kind == NODE_NUMBER && node->right->kind == NODE_NUMBER &&
+            !(node->op == OPR_DIV && node->right->value == 0))
+            return foldNumber(node, evaluate(node->op, node->left->value, node->right->value));
+        // x + 0, x - 0, x * 1, x / 1 and 0 + x, 1 * x
+        if ((node->op == OPR_ADD || node->op == OPR_SUB) && isNumber(node->right, 0))
+            return node->left;
+        if ((node->op == OPR_MUL || node->op == OPR_DIV) && isNumber(node->right, 1))
+            return node->left;
+        if ((node->op == OPR_ADD && isNumber(node->left, 0)) || (node->op == OPR_MUL && isNumber(node->left, 1)))
+            return node->right;
+        return node;
+    case NODE_ASSIGN:
+    case NODE_WRITE:
+        node->left = fold(node->left);
+        return node;
+    case NODE_BEGIN:
+    {
+        Node **link = &node->left;
+        while (*link != NULL)
         {
-            if (getSymbolValue(tokens[currentToken].value) == plussym)
-            {
-                currentToken++;
-                term();
-                // emit ADD
-                emit(2, 0, 2);
-            }
+            Node *next = (*link)->next;
+            Node *child = fold(*link);
+            if (child == NULL)
+                *link = next;
             else
             {
-                currentToken++;
-                term();
-                // emit SUB
-                emit(2, 0, 3);
+                child->next = next;
+                *link = child;
+                link = &child->next;
             }
         }
+        return node;
+    }
+    case NODE_IF:
+        node->left = fold(node->left);
+        node->right = fold(node->right);
+        node->third = fold(node->third);
+        if (node->left->kind == NODE_NUMBER)
+            return node->left->value ? node->right : node->third;
+        return node;
+    case NODE_WHILE:
+        node->left = fold(node->left);
+        node->right = fold(node->right);
+        if (isNumber(node->left, 0))
+            return NULL;
+        return node;
+    case NODE_BLOCK:
+        for (Node *proc = node->left; proc != NULL; proc = proc->next)
+            fold(proc);
+        node->right = fold(node->right);
+        return node;
+    default:
+        return node;
     }
 }
 
-void term()
+// loop invariant code motion: the largest subexpressions of a while loop
+// that read no variable the loop can store, itself or through the
+// procedures it calls, are computed once into compiler temporaries ahead of
+// the loop. divisions stay put, a loop that never runs must not fault
+Node **procedureBlock = NULL; // BLOCK of each procedure symbol
+int procedureCapacity = 0;
+char *storedInLoop = NULL;
+int storedCapacity = 0;
+char *procedureSeen = NULL;
+int seenCapacity = 0;
+
+Node *hoistBlock;       // block that owns the temporaries
+int hoistDepth;         // its level
+Node *preheader;        // assignments to temporaries, chained through next
+Node **preheaderEnd;
+int hoistedCount = 0;
+int temporaryCount = 0;
+
+void findProcedures(Node *block)
 {
-    factor();
-    while (getSymbolValue(tokens[currentToken].value) == multsym || getSymbolValue(tokens[currentToken].value) == slashsym)
+    for (Node *proc = block->left; proc != NULL; proc = proc->next)
     {
-        if (getSymbolValue(tokens[currentToken].value) == multsym)
-        {
-            currentToken++;
-            factor();
-            // emit MUL
-            emit(2, 0, 3);
-        }
-        else
-        {
-            currentToken++;
-            factor();
-            // emit DIV
-            emit(2, 0, 4);
-        }
+        procedureBlock[proc->value] = proc;
+        findProcedures(proc);
     }
 }
 
-void factor()
+// the mod set of a statement: every variable it can store, following calls
+void markStores(Node *node)
 {
-    if (tokens[currentToken].type == IDENTIFIER)
+    if (node == NULL)
+        return;
+    switch (node->kind)
     {
-        int symIdx = symbolTableCheck(tokens[currentToken].value);
-        if (symIdx == -1)
-            printError(6);
-        if (symbol_table[symIdx].kind == 1)
-        {
-            // emit LIT(M=table[symIdx].val)
-            emit(1, 0, symbol_table[symIdx].val);
-        }
-        else if (symbol_table[symIdx].kind == 2)
+    case NODE_ASSIGN:
+    case NODE_READ:
+        storedInLoop[node->value] = 1;
+        break;
+    case NODE_CALL:
+        if (!procedureSeen[node->value])
         {
-            // emit LOD(M=table[symIdx].addr)
-            emit(3, 0, symbol_table[symIdx].addr);
+            procedureSeen[node->value] = 1;
+            markStores(procedureBlock[node->value]->right);
         }
-        else
-            printError(7);
-        currentToken++;
-    }
-    // else if (atoi(tokens[currentToken].value) == numbersym)
-    else if (tokens[currentToken].type == NUMBER)
-    {
-        // emit LIT
-        emit(1, 0, atoi(tokens[currentToken].value));
-        currentToken++;
+        break;
+    case NODE_BEGIN:
+        for (Node *child = node->left; child != NULL; child = child->next)
+            markStores(child);
+        break;
+    case NODE_IF:
+        markStores(node->right);
+        markStores(node->third);
+        break;
+    case NODE_WHILE:
+        markStores(node->right);
+        break;
     }
-    else if (
-        // atoi(tokens[currentToken].value) == lparentsym)
-        getSymbolValue(tokens[currentToken].value) == lparentsym)
+}
+
+int isInvariant(Node *node)
+{
+    switch (node->kind)
     {
-        currentToken++;
-        expression();
-        if (atoi(tokens[currentToken].value) != rparentsym)
-            printError(13);
-        currentToken++;
+    case NODE_NUMBER:
+        return 1;
+    case NODE_VAR:
+        return symbol_table[node->value].kind == 1 || !storedInLoop[node->value];
+    case NODE_NEG:
+    case NODE_ODD:
+        return isInvariant(node->left);
+    case NODE_BINARY:
+        return node->op != OPR_DIV && isInvariant(node->left) && isInvariant(node->right);
+    default:
+        return 0;
     }
-    else
-        printError(14);
 }
 
-int main(int argc, char *argv[])
+int sameTree(Node *a, Node *b)
 {
-    // if (argc < 2)
-    // {
-    //     printf("Usage: %s <input>\n", argv[0]);
-    //     return 1;
-    // }
-
-    // read file
-    // readFile(argv[1]);
-    readFile("inputs/input.txt");
-
-    // tokenize
-    tokenize();
+    if (a == NULL || b == NULL)
+        return a == b;
+    return a->kind == b->kind && a->op == b->op && a->value == b->value &&
+           sameTree(a->left, b->left) && sameTree(a->right, b->right);
+}
 
-    // checking error
-    for (int i = 0; i < tokenCount; i++)
+// the temporary holding node, shared with an equal expression already hoisted
+int temporaryFor(Node *node)
+{
+    for (Node *assign = preheader; assign != NULL; assign = assign->next)
     {
-        if (tokens[i].type == IDENTIFIER && strlen(tokens[i].value) > 11)
-            printf("Error: Name is too long\n");
-        else if (tokens[i].type == NUMBER && strlen(tokens[i].value) > 5)
-            printf("Error: Number is too long\n");
-        else if (tokens[i].type == SYMBOL && getSymbolValue(tokens[i].value) == -1)
-            printf("Error: Invalid symbol\n");
+        if (sameTree(assign->left, node))
+            return assign->value;
     }
 
-    program();
+    // a variable of the block, out of scope as soon as it is declared
+    char text[16];
+    int length = snprintf(text, sizeof(text), "$t%d", ++temporaryCount);
+    hoistBlock->op++;
+    addSymbol(2, internName(text, length), 0, hoistDepth, 2 + hoistBlock->op);
+    popScope(symbolTableIndex - 1);
 
-    // print assembly code
-    printf("Assembly code:\n");
-    printf("Line\tOP\tL\tM\n");
+    Node *assign = newNode(NODE_ASSIGN);
+    assign->value = symbolTableIndex - 1;
+    assign->left = node;
+    *preheaderEnd = assign;
+    preheaderEnd = &assign->next;
+    return assign->value;
+}
+
+void hoistExpression(Node **link)
+{
+    Node *node = *link;
+    if (node->kind == NODE_NUMBER || node->kind == NODE_VAR)
+        return;
+    if (isInvariant(node))
+    {
+        Node *temporary = newNode(NODE_VAR);
+        temporary->value = temporaryFor(node);
+        *link = temporary;
+        hoistedCount++;
+        return;
+    }
+    hoistExpression(&node->left);
+    if (node->kind == NODE_BINARY)
+        hoistExpression(&node->right);
+}
+
+void hoistStatement(Node *node)
+{
+    if (node == NULL)
+        return;
+    switch (node->kind)
+    {
+    case NODE_ASSIGN:
+    case NODE_WRITE:
+        hoistExpression(&node->left);
+        break;
+    case NODE_BEGIN:
+        for (Node *child = node->left; child != NULL; child = child->next)
+            hoistStatement(child);
+        break;
+    case NODE_IF:
+        hoistExpression(&node->left);
+        hoistStatement(node->right);
+        hoistStatement(node->third);
+        break;
+    case NODE_WHILE:
+        hoistExpression(&node->left);
+        hoistStatement(node->right);
+        break;
+    }
+}
+
+// outer loops first, what they leave behind can still leave inner loops.
+// a loop with hoisted expressions becomes begin <temporaries>; <loop> end
+Node *hoistLoops(Node *node)
+{
+    if (node == NULL)
+        return NULL;
+    switch (node->kind)
+    {
+    case NODE_BEGIN:
+        for (Node **link = &node->left; *link != NULL; link = &(*link)->next)
+        {
+            Node *next = (*link)->next;
+            *link = hoistLoops(*link);
+            (*link)->next = next;
+        }
+        return node;
+    case NODE_IF:
+        node->right = hoistLoops(node->right);
+        node->third = hoistLoops(node->third);
+        return node;
+    case NODE_WHILE:
+    {
+        storedInLoop = arenaGrow(storedInLoop, &storedCapacity, symbolTableIndex, 1);
+        procedureSeen = arenaGrow(procedureSeen, &seenCapacity, symbolTableIndex, 1);
+        memset(storedInLoop, 0, symbolTableIndex);
+        memset(procedureSeen, 0, symbolTableIndex);
+        markStores(node->right);
+
+        preheader = NULL;
+        preheaderEnd = &preheader;
+        hoistExpression(&node->left);
+        hoistStatement(node->right);
+        Node *assignments = preheader;
+        Node **assignmentsEnd = preheaderEnd;
+
+        node->right = hoistLoops(node->right);
+        if (assignments == NULL)
+            return node;
+        Node *begin = newNode(NODE_BEGIN);
+        begin->left = assignments;
+        *assignmentsEnd = node;
+        node->next = NULL;
+        return begin;
+    }
+    case NODE_BLOCK:
+    {
+        for (Node *proc = node->left; proc != NULL; proc = proc->next)
+        {
+            hoistDepth++;
+            hoistLoops(proc);
+            hoistDepth--;
+        }
+        hoistBlock = node;
+        node->right = hoistLoops(node->right);
+        return node;
+    }
+    default:
+        return node;
+    }
+}
+
+Node *hoistInvariants(Node *root)
+{
+    procedureBlock = arenaGrow(procedureBlock, &procedureCapacity, symbolTableIndex, sizeof(Node *));
+    findProcedures(root);
+    hoistDepth = 0;
+    return hoistLoops(root);
+}
+
+// inlining: a call to a small procedure that declares no procedures of its
+// own and cannot reach itself through the call graph is replaced by a copy
+// of its body. the callee's variables become variables of the calling
+// block, every other name keeps its level, which stays in reach because a
+// caller is always nested in the block that declares the callee. procedures
+// the main block can no longer reach are dropped
+int inlineThreshold = 40; // tree nodes, a body must be smaller
+int inlinedCount = 0;
+int droppedCount = 0;
+char *canInline = NULL;
+int canInlineCapacity = 0;
+Node **inlineCaller = NULL; // block the callee's variables were last added to
+int inlineCallerCapacity = 0;
+int *inlineFirst = NULL;    // and the first of them
+int inlineFirstCapacity = 0;
+int *inlinedLocals = NULL;  // first variable inlining added to a procedure's block
+int inlinedLocalsCapacity = 0;
+int parsedSymbols;          // symbols declared in the source, the rest were added
+
+Node *callerBlock; // block whose body is being inlined into
+int callerDepth;
+
+int treeSize(Node *node)
+{
+    int size = 0;
+    for (; node != NULL; node = node->next)
+        size += 1 + treeSize(node->left) + treeSize(node->right) + treeSize(node->third);
+    return size;
+}
+
+// whether the statement can call target, directly or through other procedures
+int callsProcedure(Node *node, int target)
+{
+    if (node == NULL)
+        return 0;
+    switch (node->kind)
+    {
+    case NODE_CALL:
+        if (node->value == target)
+            return 1;
+        if (procedureSeen[node->value])
+            return 0;
+        procedureSeen[node->value] = 1;
+        return callsProcedure(procedureBlock[node->value]->right, target);
+    case NODE_BEGIN:
+        for (Node *child = node->left; child != NULL; child = child->next)
+        {
+            if (callsProcedure(child, target))
+                return 1;
+        }
+        return 0;
+    case NODE_IF:
+        return callsProcedure(node->right, target) || callsProcedure(node->third, target);
+    case NODE_WHILE:
+        return callsProcedure(node->right, target);
+    default:
+        return 0;
+    }
+}
+
+void findInlinable(Node *block)
+{
+    for (Node *proc = block->left; proc != NULL; proc = proc->next)
+    {
+        memset(procedureSeen, 0, symbolTableIndex);
+        canInline[proc->value] = proc->left == NULL && treeSize(proc->right) < inlineThreshold &&
+                                 !callsProcedure(proc->right, proc->value);
+        findInlinable(proc);
+    }
+}
+
+// the body with the callee's variables, those at calleeLevel, renamed
+Node *copyTree(Node *node, int calleeLevel, int firstLocal)
+{
+    if (node == NULL)
+        return NULL;
+    Node *copy = newNode(node->kind);
+    *copy = *node;
+    if ((node->kind == NODE_VAR || node->kind == NODE_ASSIGN || node->kind == NODE_READ) &&
+        symbol_table[node->value].kind == 2 && symbol_table[node->value].level == calleeLevel)
+        copy->value = firstLocal + symbol_table[node->value].addr - 3;
+    copy->left = copyTree(node->left, calleeLevel, firstLocal);
+    copy->right = copyTree(node->right, calleeLevel, firstLocal);
+    copy->third = copyTree(node->third, calleeLevel, firstLocal);
+    copy->next = copyTree(node->next, calleeLevel, firstLocal);
+    return copy;
+}
+
+// the variable at addr in the block of procedure procIdx. its declared
+// variables follow it in the table, up to the end of its declarations. those
+// it got from inlined calls were added while its own body was inlined into,
+// which is done before any call to it is inlined
+int blockVariable(int procIdx, int addr)
+{
+    int calleeLevel = symbol_table[procIdx].level + 1;
+    for (int s = procIdx + 1; s < parsedSymbols && symbol_table[s].level >= calleeLevel; s++)
+    {
+        if (symbol_table[s].kind == 2 && symbol_table[s].level == calleeLevel && symbol_table[s].addr == addr)
+            return s;
+    }
+    for (int s = inlinedLocals[procIdx]; s < symbolTableIndex; s++)
+    {
+        if (symbol_table[s].kind == 2 && symbol_table[s].level == calleeLevel && symbol_table[s].addr == addr)
+            return s;
+    }
+    return -1;
+}
+
+// the callee's variables in the calling block, shared by all its calls there
+int inlineLocals(int procIdx)
+{
+    Node *callee = procedureBlock[procIdx];
+    if (callee->op == 0 || inlineCaller[procIdx] == callerBlock)
+        return inlineFirst[procIdx];
+    inlineCaller[procIdx] = callerBlock;
+    inlineFirst[procIdx] = symbolTableIndex;
+    for (int addr = 3; addr < 3 + callee->op; addr++)
+    {
+        callerBlock->op++;
+        addSymbol(2, symbol_table[blockVariable(procIdx, addr)].name, 0, callerDepth, 2 + callerBlock->op);
+        popScope(symbolTableIndex - 1);
+    }
+    return inlineFirst[procIdx];
+}
+
+Node *inlineCalls(Node *node)
+{
+    if (node == NULL)
+        return NULL;
+    switch (node->kind)
+    {
+    case NODE_CALL:
+    {
+        int procIdx = node->value;
+        if (!canInline[procIdx])
+            return node;
+        int first = inlineLocals(procIdx);
+        inlinedCount++;
+        // calls in the copy are inlined in turn, none of them leads back here
+        return inlineCalls(copyTree(procedureBlock[procIdx]->right, symbol_table[procIdx].level + 1, first));
+    }
+    case NODE_BEGIN:
+    {
+        Node **link = &node->left;
+        while (*link != NULL)
+        {
+            Node *next = (*link)->next;
+            Node *child = inlineCalls(*link);
+            if (child == NULL)
+                *link = next;
+            else
+            {
+                child->next = next;
+                *link = child;
+                link = &child->next;
+            }
+        }
+        return node;
+    }
+    case NODE_IF:
+        node->right = inlineCalls(node->right);
+        node->third = inlineCalls(node->third);
+        return node;
+    case NODE_WHILE:
+        node->right = inlineCalls(node->right);
+        return node;
+    case NODE_BLOCK:
+        for (Node *proc = node->left; proc != NULL; proc = proc->next)
+        {
+            callerDepth++;
+            inlineCalls(proc);
+            callerDepth--;
+        }
+        callerBlock = node;
+        if (node->value >= 0)
+            inlinedLocals[node->value] = symbolTableIndex;
+        node->right = inlineCalls(node->right);
+        return node;
+    default:
+        return node;
+    }
+}
+
+// unlink the procedures the main block does not reach, marked by callsProcedure()
+void dropProcedures(Node *block)
+{
+    Node **link = &block->left;
+    while (*link != NULL)
+    {
+        if (procedureSeen[(*link)->value])
+        {
+            dropProcedures(*link);
+            link = &(*link)->next;
+        }
+        else
+        {
+            *link = (*link)->next;
+            droppedCount++;
+        }
+    }
+}
+
+Node *inlineProcedures(Node *root)
+{
+    procedureBlock = arenaGrow(procedureBlock, &procedureCapacity, symbolTableIndex, sizeof(Node *));
+    procedureSeen = arenaGrow(procedureSeen, &seenCapacity, symbolTableIndex, 1);
+    canInline = arenaGrow(canInline, &canInlineCapacity, symbolTableIndex, 1);
+    inlineCaller = arenaGrow(inlineCaller, &inlineCallerCapacity, symbolTableIndex, sizeof(Node *));
+    inlineFirst = arenaGrow(inlineFirst, &inlineFirstCapacity, symbolTableIndex, sizeof(int));
+    inlinedLocals = arenaGrow(inlinedLocals, &inlinedLocalsCapacity, symbolTableIndex, sizeof(int));
+    parsedSymbols = symbolTableIndex;
+    memset(canInline, 0, symbolTableIndex);
+    memset(inlineCaller, 0, symbolTableIndex * sizeof(Node *));
+    findProcedures(root);
+    findInlinable(root);
+
+    callerDepth = 0;
+    root = inlineCalls(root);
+
+    memset(procedureSeen, 0, symbolTableIndex);
+    callsProcedure(root->right, -1);
+    dropProcedures(root);
+    return root;
+}
+
+// SSA middle end: the body of a block is rebuilt as a control flow graph
+// of basic blocks holding values in SSA form, built straight from the tree
+// with sealed blocks and incomplete phis. variables of the block that no
+// nested procedure can reach are promoted to SSA values, all others stay
+// explicit loads and stores. sparse conditional constant propagation, copy
+// propagation, global value numbering and dead store elimination run on
+// it, then lowering turns it back into stack code: a value used once later
+// in its basic block is computed where it is used, every other one lives in
+// a frame slot, its variable's own slot unless another value of that
+// variable is live at the same time, otherwise a temporary
+enum
+{
+    IR_NOP,
+    IR_CONST,  // value: number
+    IR_ENTRY,  // value: promoted variable, what its slot holds when the body starts
+    IR_PHI,    // value: promoted variable, a and b: values from the first and second predecessor
+    IR_COPY,   // a
+    IR_LOAD,   // value: variable in memory
+    IR_STORE,  // value: variable in memory, a
+    IR_BINARY, // op: OPR number, a and b
+    IR_NEG,    // a
+    IR_ODD,    // a
+    IR_READ,
+    IR_WRITE,  // a
+    IR_CALL    // value: procedure symbol
+};
+
+enum
+{
+    LATTICE_TOP,
+    LATTICE_CONST,
+    LATTICE_BOTTOM
+};
+
+typedef struct
+{
+    int kind;
+    int op;
+    int value;
+    int a, b;
+    int block;
+    int link;     // next phi of the block
+    int chain;    // next value of a value numbering bucket
+    int uses;
+    int user;     // the last one found
+    int state;    // LATTICE_*
+    int constant; // when LATTICE_CONST
+    int inlined;  // computed where it is used, never stored
+    int home;     // frame address, -1 for a temporary
+    int index;    // liveness bit of a stored value, temporary number
+} Value;
+
+enum
+{
+    END_EXIT,
+    END_JUMP,  // to succ[0]
+    END_BRANCH // on cond, true to succ[0] and false to succ[1]
+};
+
+typedef struct
+{
+    int first, last; // values created while the block was filled
+    int end;
+    int cond;
+    int succ[2];
+    int pred[2];
+    int predCount;
+    int sealed;
+    int phis;        // phis and, in the first block, entry values, chained through link
+    int reachable;
+    int idom;
+    int statements;  // lowered: first of its statements in order[] and how many
+    int statementCount;
+    int top, bottom; // positions of its start and end
+    int address;     // code index
+} BasicBlock;
+
+Value *values = NULL;
+int valueCount = 0;
+int valueCapacity = 0;
+BasicBlock *blocks = NULL;
+int blockCount = 0;
+int blockCapacity = 0;
+int currentBlock = -1;
+
+char *promoted = NULL; // per symbol
+int promotedCapacity = 0;
+int ssaDepth;          // level of the block's variables
+
+// current definition of each promoted variable in each basic block
+long long *defKeys = NULL;
+int *defValues = NULL;
+int defCapacity = 0;
+int defCount = 0;
+
+int ssaEnabled = 1;
+int ssaBodies = 0;
+int ssaFallbacks = 0;
+int sccpFolded = 0;
+int sccpBranches = 0;
+int copiesPropagated = 0;
+int gvnRedundant = 0;
+int deadStores = 0;
+int ssaTemporaries = 0;
+
+int newValue(int kind, int op, int value, int a, int b)
+{
+    values = arenaGrow(values, &valueCapacity, valueCount + 1, sizeof(Value));
+    Value *v = &values[valueCount];
+    memset(v, 0, sizeof(Value));
+    v->kind = kind;
+    v->op = op;
+    v->value = value;
+    v->a = a;
+    v->b = b;
+    v->block = currentBlock;
+    v->link = -1;
+    v->home = -1;
+    return valueCount++;
+}
+
+// a new basic block reached from pred, -1 for none
+int newBlock(int pred)
+{
+    blocks = arenaGrow(blocks, &blockCapacity, blockCount + 1, sizeof(BasicBlock));
+    BasicBlock *block = &blocks[blockCount];
+    memset(block, 0, sizeof(BasicBlock));
+    block->end = END_EXIT;
+    block->cond = -1;
+    block->succ[0] = block->succ[1] = -1;
+    block->sealed = 1;
+    block->phis = -1;
+    if (pred != -1)
+        block->pred[block->predCount++] = pred;
+    return blockCount++;
+}
+
+void startBlock(int block)
+{
+    if (currentBlock != -1)
+        blocks[currentBlock].last = valueCount;
+    currentBlock = block;
+    blocks[block].first = valueCount;
+}
+
+void jumpTo(int from, int to)
+{
+    blocks[from].end = END_JUMP;
+    blocks[from].succ[0] = to;
+}
+
+unsigned int defSlot(long long key)
+{
+    return (unsigned int)((key * 0x9E3779B97F4A7C15ull) >> 40) & (defCapacity - 1);
+}
+
+void writeVariable(int var, int block, int value)
+{
+    if ((defCount + 1) * 2 > defCapacity)
+    {
+        long long *oldKeys = defKeys;
+        int *oldValues = defValues;
+        int oldCapacity = defCapacity;
+        defCapacity = defCapacity ? defCapacity * 2 : 1024;
+        defKeys = arenaAlloc(defCapacity * sizeof(long long));
+        defValues = arenaAlloc(defCapacity * sizeof(int));
+        memset(defKeys, 0xff, defCapacity * sizeof(long long));
+        for (int i = 0; i < oldCapacity; i++)
+        {
+            if (oldKeys[i] != -1)
+            {
+                unsigned int slot = defSlot(oldKeys[i]);
+                while (defKeys[slot] != -1)
+                    slot = (slot + 1) & (defCapacity - 1);
+                defKeys[slot] = oldKeys[i];
+                defValues[slot] = oldValues[i];
+            }
+        }
+    }
+    long long key = (long long)var << 32 | block;
+    unsigned int slot = defSlot(key);
+    while (defKeys[slot] != -1 && defKeys[slot] != key)
+        slot = (slot + 1) & (defCapacity - 1);
+    if (defKeys[slot] == -1)
+        defCount++;
+    defKeys[slot] = key;
+    defValues[slot] = value;
+}
+
+int lookupVariable(int var, int block)
+{
+    if (defCapacity == 0)
+        return -1;
+    long long key = (long long)var << 32 | block;
+    unsigned int slot = defSlot(key);
+    while (defKeys[slot] != -1)
+    {
+        if (defKeys[slot] == key)
+            return defValues[slot];
+        slot = (slot + 1) & (defCapacity - 1);
+    }
+    return -1;
+}
+
+int newPhi(int kind, int var, int block)
+{
+    int v = newValue(kind, 0, var, -1, -1);
+    values[v].block = block;
+    values[v].home = symbol_table[var].addr;
+    values[v].link = blocks[block].phis;
+    blocks[block].phis = v;
+    return v;
+}
+
+int readVariable(int var, int block)
+{
+    int v = lookupVariable(var, block);
+    if (v != -1)
+        return v;
+    if (!blocks[block].sealed)
+    {
+        // operands are filled in when the block is sealed
+        v = newPhi(IR_PHI, var, block);
+    }
+    else if (blocks[block].predCount == 0)
+        v = newPhi(IR_ENTRY, var, block);
+    else if (blocks[block].predCount == 1)
+        v = readVariable(var, blocks[block].pred[0]);
+    else
+    {
+        v = newPhi(IR_PHI, var, block);
+        writeVariable(var, block, v);
+        values[v].a = readVariable(var, blocks[block].pred[0]);
+        values[v].b = readVariable(var, blocks[block].pred[1]);
+    }
+    writeVariable(var, block, v);
+    return v;
+}
+
+void sealBlock(int block)
+{
+    for (int v = blocks[block].phis; v != -1; v = values[v].link)
+    {
+        if (values[v].kind == IR_PHI && values[v].a == -1)
+        {
+            values[v].a = readVariable(values[v].value, blocks[block].pred[0]);
+            values[v].b = readVariable(values[v].value, blocks[block].pred[1]);
+        }
+    }
+    blocks[block].sealed = 1;
+}
+
+// variables a nested procedure uses stay in memory
+void markEscaping(Node *node)
+{
+    for (; node != NULL; node = node->next)
+    {
+        if (node->kind == NODE_VAR || node->kind == NODE_ASSIGN || node->kind == NODE_READ)
+            promoted[node->value] = 0;
+        markEscaping(node->left);
+        markEscaping(node->right);
+        markEscaping(node->third);
+    }
+}
+
+int ssaExpression(Node *node)
+{
+    switch (node->kind)
+    {
+    case NODE_NUMBER:
+        return newValue(IR_CONST, 0, node->value, -1, -1);
+    case NODE_VAR:
+        if (symbol_table[node->value].kind == 1)
+            return newValue(IR_CONST, 0, symbol_table[node->value].val, -1, -1);
+        if (promoted[node->value])
+            return readVariable(node->value, currentBlock);
+        return newValue(IR_LOAD, 0, node->value, -1, -1);
+    case NODE_NEG:
+        return newValue(IR_NEG, 0, 0, ssaExpression(node->left), -1);
+    case NODE_ODD:
+        return newValue(IR_ODD, 0, 0, ssaExpression(node->left), -1);
+    default:
+    {
+        int a = ssaExpression(node->left);
+        int b = ssaExpression(node->right);
+        return newValue(IR_BINARY, node->op, 0, a, b);
+    }
+    }
+}
+
+void assignVariable(int var, int value)
+{
+    if (promoted[var])
+    {
+        writeVariable(var, currentBlock, value);
+        // the first variable a value is assigned to is where it is kept
+        if (values[value].home == -1)
+            values[value].home = symbol_table[var].addr;
+    }
+    else
+        newValue(IR_STORE, 0, var, value, -1);
+}
+
+void ssaStatement(Node *node)
+{
+    if (node == NULL)
+        return;
+    switch (node->kind)
+    {
+    case NODE_ASSIGN:
+        assignVariable(node->value, ssaExpression(node->left));
+        break;
+    case NODE_READ:
+        assignVariable(node->value, newValue(IR_READ, 0, 0, -1, -1));
+        break;
+    case NODE_WRITE:
+        newValue(IR_WRITE, 0, 0, ssaExpression(node->left), -1);
+        break;
+    case NODE_CALL:
+        newValue(IR_CALL, 0, node->value, -1, -1);
+        break;
+    case NODE_BEGIN:
+        for (Node *child = node->left; child != NULL; child = child->next)
+            ssaStatement(child);
+        break;
+    case NODE_IF:
+    {
+        // an else block even when there is no else, so no edge is critical
+        int cond = ssaExpression(node->left);
+        int condBlock = currentBlock;
+        blocks[condBlock].end = END_BRANCH;
+        blocks[condBlock].cond = cond;
+        blocks[condBlock].succ[0] = newBlock(condBlock);
+        startBlock(blocks[condBlock].succ[0]);
+        ssaStatement(node->right);
+        int thenEnd = currentBlock;
+        blocks[condBlock].succ[1] = newBlock(condBlock);
+        startBlock(blocks[condBlock].succ[1]);
+        ssaStatement(node->third);
+        int elseEnd = currentBlock;
+        int join = newBlock(thenEnd);
+        blocks[join].pred[blocks[join].predCount++] = elseEnd;
+        jumpTo(thenEnd, join);
+        jumpTo(elseEnd, join);
+        startBlock(join);
+        break;
+    }
+    case NODE_WHILE:
+    {
+        int header = newBlock(currentBlock);
+        blocks[header].sealed = 0;
+        jumpTo(currentBlock, header);
+        startBlock(header);
+        int cond = ssaExpression(node->left);
+        blocks[header].end = END_BRANCH;
+        blocks[header].cond = cond;
+        blocks[header].succ[0] = newBlock(header);
+        startBlock(blocks[header].succ[0]);
+        ssaStatement(node->right);
+        int latch = currentBlock;
+        jumpTo(latch, header);
+        blocks[header].pred[blocks[header].predCount++] = latch;
+        sealBlock(header);
+        blocks[header].succ[1] = newBlock(header);
+        startBlock(blocks[header].succ[1]);
+        break;
+    }
+    }
+}
+
+// the value a copy stands for
+int resolve(int v)
+{
+    while (v >= 0 && values[v].kind == IR_COPY)
+        v = values[v].a;
+    return v;
+}
+
+void resolveOperands()
+{
+    for (int v = 0; v < valueCount; v++)
+    {
+        values[v].a = resolve(values[v].a);
+        values[v].b = resolve(values[v].b);
+    }
+    for (int b = 0; b < blockCount; b++)
+        blocks[b].cond = resolve(blocks[b].cond);
+}
+
+void makeCopy(int v, int of)
+{
+    values[v].kind = IR_COPY;
+    values[v].a = of;
+    values[v].b = -1;
+    copiesPropagated++;
+}
+
+// copy propagation: phis whose operands are all one value, or themselves
+void removeTrivialPhis()
+{
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int v = 0; v < valueCount; v++)
+        {
+            if (values[v].kind != IR_PHI)
+                continue;
+            int a = resolve(values[v].a), b = resolve(values[v].b);
+            if (a == b || b == v)
+                makeCopy(v, a);
+            else if (a == v)
+                makeCopy(v, b);
+            else
+                continue;
+            changed = 1;
+        }
+    }
+    resolveOperands();
+}
+
+int isStatement(int v)
+{
+    return values[v].kind != IR_PHI && values[v].kind != IR_ENTRY;
+}
+
+// whether control goes from block from to block to as far as is known
+int edgeTaken(int from, int to)
+{
+    BasicBlock *block = &blocks[from];
+    if (!block->reachable)
+        return 0;
+    if (block->end == END_JUMP)
+        return block->succ[0] == to;
+    if (block->end == END_BRANCH)
+    {
+        Value *cond = &values[block->cond];
+        if (cond->state == LATTICE_BOTTOM)
+            return 1;
+        if (cond->state == LATTICE_CONST)
+            return block->succ[cond->constant ? 0 : 1] == to;
+    }
+    return 0;
+}
+
+void sccpEvaluate(int v)
+{
+    Value *value = &values[v];
+    int state = LATTICE_BOTTOM, constant = 0;
+    switch (value->kind)
+    {
+    case IR_CONST:
+        state = LATTICE_CONST;
+        constant = value->value;
+        break;
+    case IR_PHI:
+    {
+        // meet over the edges taken so far
+        BasicBlock *block = &blocks[value->block];
+        state = LATTICE_TOP;
+        for (int i = 0; i < block->predCount && state != LATTICE_BOTTOM; i++)
+        {
+            if (!edgeTaken(block->pred[i], value->block))
+                continue;
+            Value *operand = &values[i == 0 ? value->a : value->b];
+            if (operand->state == LATTICE_TOP)
+                continue;
+            if (operand->state == LATTICE_BOTTOM || (state == LATTICE_CONST && constant != operand->constant))
+                state = LATTICE_BOTTOM;
+            else
+            {
+                state = LATTICE_CONST;
+                constant = operand->constant;
+            }
+        }
+        break;
+    }
+    case IR_NEG:
+    case IR_ODD:
+    case IR_BINARY:
+    {
+        Value *a = &values[value->a];
+        Value *b = value->kind == IR_BINARY ? &values[value->b] : a;
+        if (a->state == LATTICE_TOP || b->state == LATTICE_TOP)
+            state = LATTICE_TOP;
+        else if (a->state == LATTICE_CONST && b->state == LATTICE_CONST)
+        {
+            state = LATTICE_CONST;
+            if (value->kind == IR_NEG)
+                constant = (int)(0u - (unsigned)a->constant);
+            else if (value->kind == IR_ODD)
+                constant = a->constant % 2;
+            else if ((value->op == OPR_DIV && b->constant == 0) ||
+                     ((value->op == OPR_SHL || value->op == OPR_SHR) && (b->constant < 0 || b->constant > 30)))
+                state = LATTICE_BOTTOM;
+            else
+                constant = evaluate(value->op, a->constant, b->constant);
+        }
+        break;
+    }
+    }
+    if (state != value->state || constant != value->constant)
+    {
+        value->state = state;
+        value->constant = constant;
+    }
+}
+
+// sparse conditional constant propagation, iterated over the blocks in
+// order until nothing changes. values that are constant become constants,
+// branches on them jumps, and blocks never reached are dropped
+void sccp()
+{
+    for (int v = 0; v < valueCount; v++)
+        values[v].state = LATTICE_TOP;
+    for (int b = 0; b < blockCount; b++)
+        blocks[b].reachable = b == 0;
+
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int b = 0; b < blockCount; b++)
+        {
+            if (!blocks[b].reachable)
+                continue;
+            for (int v = blocks[b].phis; v != -1; v = values[v].link)
+            {
+                int state = values[v].state, constant = values[v].constant;
+                sccpEvaluate(v);
+                changed |= state != values[v].state || constant != values[v].constant;
+            }
+            for (int v = blocks[b].first; v < blocks[b].last; v++)
+            {
+                if (values[v].block != b || !isStatement(v))
+                    continue;
+                int state = values[v].state, constant = values[v].constant;
+                sccpEvaluate(v);
+                changed |= state != values[v].state || constant != values[v].constant;
+            }
+            for (int i = 0; i < 2; i++)
+            {
+                int succ = blocks[b].succ[i];
+                if (succ != -1 && !blocks[succ].reachable && edgeTaken(b, succ))
+                    blocks[succ].reachable = changed = 1;
+            }
+        }
+    }
+
+    for (int v = 0; v < valueCount; v++)
+    {
+        Value *value = &values[v];
+        if (value->state == LATTICE_CONST && value->kind != IR_CONST &&
+            (value->kind == IR_PHI || value->kind == IR_BINARY || value->kind == IR_NEG || value->kind == IR_ODD) &&
+            blocks[value->block].reachable)
+        {
+            value->kind = IR_CONST;
+            value->value = value->constant;
+            value->a = value->b = -1;
+            sccpFolded++;
+        }
+    }
+    for (int b = 0; b < blockCount; b++)
+    {
+        BasicBlock *block = &blocks[b];
+        if (block->reachable && block->end == END_BRANCH && values[block->cond].kind == IR_CONST)
+        {
+            block->succ[0] = block->succ[values[block->cond].value ? 0 : 1];
+            block->succ[1] = -1;
+            block->end = END_JUMP;
+            block->cond = -1;
+            sccpBranches++;
+        }
+    }
+
+    // predecessors that are gone take their phi operands with them
+    for (int b = 0; b < blockCount; b++)
+    {
+        BasicBlock *block = &blocks[b];
+        if (!block->reachable || block->predCount == 0)
+            continue;
+        int keep[2], count = 0;
+        for (int i = 0; i < block->predCount; i++)
+        {
+            BasicBlock *pred = &blocks[block->pred[i]];
+            keep[i] = pred->reachable && (pred->succ[0] == b || pred->succ[1] == b);
+            count += keep[i];
+        }
+        if (count == block->predCount)
+            continue;
+        for (int v = block->phis; v != -1; v = values[v].link)
+        {
+            if (values[v].kind == IR_PHI)
+                makeCopy(v, keep[0] ? values[v].a : values[v].b);
+        }
+        if (!keep[0])
+            block->pred[0] = block->pred[1];
+        block->predCount = count;
+    }
+    resolveOperands();
+    removeTrivialPhis();
+}
+
+int intersect(int a, int b)
+{
+    while (a != b)
+    {
+        while (a > b)
+            a = blocks[a].idom;
+        while (b > a)
+            b = blocks[b].idom;
+    }
+    return a;
+}
+
+// dominators by iterating over the blocks in creation order, which for
+// this structured code is a reverse postorder and a preorder of the tree
+void dominators()
+{
+    for (int b = 0; b < blockCount; b++)
+        blocks[b].idom = b == 0 ? 0 : -1;
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int b = 1; b < blockCount; b++)
+        {
+            if (!blocks[b].reachable)
+                continue;
+            int idom = -1;
+            for (int i = 0; i < blocks[b].predCount; i++)
+            {
+                int pred = blocks[b].pred[i];
+                if (blocks[pred].idom != -1)
+                    idom = idom == -1 ? pred : intersect(pred, idom);
+            }
+            if (idom != blocks[b].idom)
+            {
+                blocks[b].idom = idom;
+                changed = 1;
+            }
+        }
+    }
+}
+
+unsigned int gvnHash(Value *value, int size)
+{
+    unsigned int h = value->kind * 31u + value->op;
+    h = h * 0x9E3779B1u + (unsigned)value->value;
+    h = h * 0x9E3779B1u + (unsigned)value->a;
+    h = h * 0x9E3779B1u + (unsigned)value->b;
+    return (h ^ h >> 15) & (size - 1);
+}
+
+int isCommutative(int op)
+{
+    return op == OPR_ADD || op == OPR_MUL || op == OPR_EQL || op == OPR_NEQ || op == OPR_AND;
+}
+
+// global value numbering: one constant per number, and an expression
+// computed again where an equal one dominates it is replaced by it. the
+// blocks are walked in dominator tree preorder with a scoped hash table
+void valueNumbering()
+{
+    int size = 1024;
+    while (size < valueCount * 2)
+        size *= 2;
+    int *buckets = arenaAlloc(size * sizeof(int));
+    memset(buckets, 0xff, size * sizeof(int));
+
+    for (int v = 0; v < valueCount; v++)
+    {
+        Value *value = &values[v];
+        if (value->kind != IR_CONST || !blocks[value->block].reachable)
+            continue;
+        unsigned int h = gvnHash(value, size);
+        int found = buckets[h];
+        while (found != -1 && values[found].value != value->value)
+            found = values[found].chain;
+        if (found != -1)
+            makeCopy(v, found);
+        else
+        {
+            value->chain = buckets[h];
+            buckets[h] = v;
+        }
+    }
+    resolveOperands();
+    memset(buckets, 0xff, size * sizeof(int));
+
+    dominators();
+    int *stack = arenaAlloc(valueCount * sizeof(int) + 1);
+    int *scopeBlock = arenaAlloc(blockCount * sizeof(int));
+    int *scopeStart = arenaAlloc(blockCount * sizeof(int));
+    int top = 0, scopes = 0;
+    for (int b = 0; b < blockCount; b++)
+    {
+        if (!blocks[b].reachable)
+            continue;
+        while (scopes > 0 && scopeBlock[scopes - 1] != blocks[b].idom)
+        {
+            scopes--;
+            while (top > scopeStart[scopes])
+            {
+                int v = stack[--top];
+                buckets[gvnHash(&values[v], size)] = values[v].chain;
+            }
+        }
+        scopeBlock[scopes] = b;
+        scopeStart[scopes++] = top;
+
+        for (int v = blocks[b].first; v < blocks[b].last; v++)
+        {
+            Value *value = &values[v];
+            if (value->block != b || (value->kind != IR_BINARY && value->kind != IR_NEG && value->kind != IR_ODD))
+                continue;
+            value->a = resolve(value->a);
+            value->b = resolve(value->b);
+            if (value->kind == IR_BINARY && isCommutative(value->op) && value->a > value->b)
+            {
+                int swap = value->a;
+                value->a = value->b;
+                value->b = swap;
+            }
+            unsigned int h = gvnHash(value, size);
+            int found = buckets[h];
+            while (found != -1 && !(values[found].kind == value->kind && values[found].op == value->op &&
+                                    values[found].a == value->a && values[found].b == value->b))
+                found = values[found].chain;
+            if (found != -1)
+            {
+                makeCopy(v, found);
+                gvnRedundant++;
+            }
+            else
+            {
+                value->chain = buckets[h];
+                buckets[h] = v;
+                stack[top++] = v;
+            }
+        }
+    }
+    resolveOperands();
+}
+
+// dead store elimination: a store to a variable in memory that is stored
+// again before anything can load it, in the same basic block, or that
+// reaches the end of the body when the variable belongs to this block
+void deadStoreElimination()
+{
+    int *stamp = arenaAlloc(symbolTableIndex * sizeof(int));
+    memset(stamp, 0, symbolTableIndex * sizeof(int));
+    int current = 0;
+    for (int b = 0; b < blockCount; b++)
+    {
+        if (!blocks[b].reachable)
+            continue;
+        current++;
+        if (blocks[b].end == END_EXIT)
+        {
+            for (int s = 0; s < symbolTableIndex; s++)
+            {
+                if (symbol_table[s].kind == 2 && symbol_table[s].level == ssaDepth && !promoted[s])
+                    stamp[s] = current;
+            }
+        }
+        for (int v = blocks[b].last - 1; v >= blocks[b].first; v--)
+        {
+            Value *value = &values[v];
+            if (value->block != b)
+                continue;
+            if (value->kind == IR_STORE)
+            {
+                if (stamp[value->value] == current)
+                {
+                    value->kind = IR_NOP;
+                    deadStores++;
+                }
+                stamp[value->value] = current;
+            }
+            else if (value->kind == IR_LOAD)
+                stamp[value->value] = 0;
+            else if (value->kind == IR_CALL)
+                current++;
+        }
+    }
+}
+
+int isRemovable(Value *value)
+{
+    switch (value->kind)
+    {
+    case IR_CONST:
+    case IR_ENTRY:
+    case IR_PHI:
+    case IR_LOAD:
+    case IR_NEG:
+    case IR_ODD:
+        return 1;
+    case IR_BINARY:
+        // a division may fault unless it is by a constant other than 0 and -1
+        return value->op != OPR_DIV ||
+               (values[value->b].kind == IR_CONST && values[value->b].value != 0 && values[value->b].value != -1);
+    default:
+        return 0;
+    }
+}
+
+void addUse(int v, int user)
+{
+    if (v >= 0)
+    {
+        values[v].uses++;
+        values[v].user = user;
+    }
+}
+
+void countUses()
+{
+    for (int v = 0; v < valueCount; v++)
+        values[v].uses = 0;
+    for (int v = 0; v < valueCount; v++)
+    {
+        if (values[v].kind != IR_NOP && values[v].kind != IR_COPY && blocks[values[v].block].reachable)
+        {
+            addUse(values[v].a, v);
+            addUse(values[v].b, v);
+        }
+    }
+    for (int b = 0; b < blockCount; b++)
+    {
+        if (blocks[b].reachable && blocks[b].end == END_BRANCH)
+            addUse(blocks[b].cond, -2 - b);
+    }
+}
+
+// values nothing uses are removed
+void deadCodeElimination()
+{
+    countUses();
+    int *work = arenaAlloc(valueCount * sizeof(int) + 1);
+    int count = 0;
+    for (int v = 0; v < valueCount; v++)
+    {
+        if (values[v].uses == 0 && blocks[values[v].block].reachable && isRemovable(&values[v]))
+            work[count++] = v;
+    }
+    while (count > 0)
+    {
+        Value *value = &values[work[--count]];
+        if (value->kind == IR_NOP)
+            continue;
+        int operands[2] = {value->a, value->b};
+        value->kind = IR_NOP;
+        for (int i = 0; i < 2; i++)
+        {
+            int o = operands[i];
+            if (o >= 0 && --values[o].uses == 0 && isRemovable(&values[o]))
+                work[count++] = o;
+        }
+    }
+}
+
+
+// lowering
+
+int *order = NULL; // statements of the reachable blocks, block by block
+int orderCapacity = 0;
+int orderCount = 0;
+unsigned long long *liveIn = NULL; // per block, bits of stored values
+unsigned long long *live = NULL;
+int liveWords;
+int *homeLive = NULL; // stored values live per frame address
+
+typedef struct
+{
+    int index;  // code index of the JMP or JPC
+    int target; // basic block
+} Fixup;
+
+Fixup *fixups = NULL;
+int fixupCapacity = 0;
+int fixupCount = 0;
+
+int producesValue(Value *value)
+{
+    return value->kind == IR_LOAD || value->kind == IR_BINARY || value->kind == IR_NEG ||
+           value->kind == IR_ODD || value->kind == IR_READ;
+}
+
+// whether the value at order[i] can wait to be computed at order[target]
+int canDelay(int i, int target)
+{
+    Value *value = &values[order[i]];
+    if (value->kind == IR_READ)
+        return target == i + 1;
+    if (value->kind != IR_LOAD && !(value->kind == IR_BINARY && value->op == OPR_DIV))
+        return 1;
+    for (int j = i + 1; j < target; j++)
+    {
+        Value *between = &values[order[j]];
+        if (between->kind == IR_CALL)
+            return 0;
+        if (value->kind == IR_LOAD && between->kind == IR_STORE && between->value == value->value)
+            return 0;
+        // a division that faults must do so after the same output
+        if (value->kind == IR_BINARY && (between->kind == IR_READ || between->kind == IR_WRITE))
+            return 0;
+    }
+    return 1;
+}
+
+// a value used once, by a later statement of its own basic block, is
+// computed right where it is used. decided backwards, so the place a
+// statement itself ends up computed is known
+void chooseInlined(int b)
+{
+    int *at = arenaAlloc(blocks[b].statementCount * sizeof(int) + 1);
+    int *list = order + blocks[b].statements;
+    int n = blocks[b].statementCount;
+    for (int i = 0; i < n; i++)
+        values[list[i]].index = i;
+    for (int i = n - 1; i >= 0; i--)
+    {
+        Value *value = &values[list[i]];
+        at[i] = i;
+        if (!producesValue(value) || value->uses != 1)
+            continue;
+        int target = -1;
+        if (value->user == -2 - b)
+            target = n;
+        else if (value->user >= 0 && values[value->user].block == b && isStatement(value->user))
+            target = at[values[value->user].index];
+        if (target != -1 && target - i <= 64 && canDelay(blocks[b].statements + i, blocks[b].statements + target))
+        {
+            value->inlined = 1;
+            at[i] = target;
+        }
+    }
+}
+
+int isStored(int v)
+{
+    return values[v].kind != IR_CONST && !values[v].inlined;
+}
+
+int isLive(int v)
+{
+    return live[values[v].index >> 6] >> (values[v].index & 63) & 1;
+}
+
+void setLive(int v)
+{
+    if (!isLive(v))
+    {
+        live[values[v].index >> 6] |= 1ull << (values[v].index & 63);
+        if (values[v].home >= 0)
+            homeLive[values[v].home]++;
+    }
+}
+
+void clearLive(int v)
+{
+    if (isLive(v))
+    {
+        live[values[v].index >> 6] &= ~(1ull << (values[v].index & 63));
+        if (values[v].home >= 0)
+            homeLive[values[v].home]--;
+    }
+}
+
+// the stored values computing v reads, through the ones computed in place
+void liveUses(int v)
+{
+    int operands[2] = {values[v].a, values[v].b};
+    for (int i = 0; i < 2; i++)
+    {
+        int o = operands[i];
+        if (o < 0 || values[o].kind == IR_CONST)
+            continue;
+        if (values[o].inlined)
+            liveUses(o);
+        else
+            setLive(o);
+    }
+}
+
+// the operand of a phi of block to that comes from block from
+int phiOperand(int phi, int from, int to)
+{
+    return blocks[to].pred[0] == from ? values[phi].a : values[phi].b;
+}
+
+// what the successors of a block need, phi operands included, with the
+// live count of each home taken from the set
+void liveAtEnd(int b, int *stored, int storedCount)
+{
+    memset(live, 0, liveWords * sizeof(long long));
+    for (int i = 0; i < 2; i++)
+    {
+        int succ = blocks[b].succ[i];
+        if (succ == -1)
+            continue;
+        for (int w = 0; w < liveWords; w++)
+            live[w] |= liveIn[(size_t)succ * liveWords + w];
+        for (int phi = blocks[succ].phis; phi != -1; phi = values[phi].link)
+        {
+            int operand = phiOperand(phi, b, succ);
+            if (values[phi].kind == IR_PHI && isStored(operand))
+                live[values[operand].index >> 6] |= 1ull << (values[operand].index & 63);
+        }
+    }
+    for (int i = 0; i < storedCount; i++)
+    {
+        if (isLive(stored[i]) && values[stored[i]].home >= 0)
+            homeLive[values[stored[i]].home]++;
+    }
+}
+
+// walk a block backwards from its live out set to its live in set. when
+// evicting, a stored value defined while another value with the same home
+// is live becomes a temporary. returns how many did
+int walkBlock(int b, int evict)
+{
+    int evicted = 0;
+    BasicBlock *block = &blocks[b];
+    if (block->end == END_BRANCH && isStored(block->cond))
+        setLive(block->cond);
+    else if (block->end == END_BRANCH && values[block->cond].inlined)
+        liveUses(block->cond);
+    for (int i = block->statementCount - 1; i >= 0; i--)
+    {
+        int v = order[block->statements + i];
+        if (values[v].inlined)
+            continue;
+        if (producesValue(&values[v]))
+        {
+            clearLive(v);
+            if (evict && values[v].home >= 0 && homeLive[values[v].home] > 0)
+            {
+                values[v].home = -1;
+                evicted++;
+            }
+        }
+        liveUses(v);
+    }
+    for (int phi = block->phis; phi != -1; phi = values[phi].link)
+    {
+        if (values[phi].kind == IR_PHI || values[phi].kind == IR_ENTRY)
+            clearLive(phi);
+    }
+    for (int phi = block->phis; phi != -1; phi = values[phi].link)
+    {
+        if (evict && values[phi].kind == IR_PHI && values[phi].home >= 0 && homeLive[values[phi].home] > 0)
+        {
+            values[phi].home = -1;
+            evicted++;
+        }
+    }
+    return evicted;
+}
+
+// drop the home counts of what is left live
+void forgetLive(int *stored, int storedCount)
+{
+    for (int i = 0; i < storedCount; i++)
+    {
+        if (isLive(stored[i]) && values[stored[i]].home >= 0)
+            homeLive[values[stored[i]].home]--;
+    }
+}
+
+int *intervalStart = NULL; // per temporary
+int *intervalEnd = NULL;
+
+void extend(int v, int position)
+{
+    if (values[v].home != -1)
+        return;
+    int t = values[v].index;
+    if (position < intervalStart[t])
+        intervalStart[t] = position;
+    if (position > intervalEnd[t])
+        intervalEnd[t] = position;
+}
+
+void extendUses(int v, int position)
+{
+    int operands[2] = {values[v].a, values[v].b};
+    for (int i = 0; i < 2; i++)
+    {
+        int o = operands[i];
+        if (o < 0 || values[o].kind == IR_CONST)
+            continue;
+        if (values[o].inlined)
+            extendUses(o, position);
+        else
+            extend(o, position);
+    }
+}
+
+int compareStart(const void *a, const void *b)
+{
+    return intervalStart[*(const int *)a] - intervalStart[*(const int *)b];
+}
+
+void pushValue(int v);
+
+void computeValue(int v)
+{
+    Value *value = &values[v];
+    switch (value->kind)
+    {
+    case IR_LOAD:
+        // emit LOD(L=level difference, M=table[symIdx].addr)
+        emit(3, level - symbol_table[value->value].level, symbol_table[value->value].addr);
+        break;
+    case IR_READ:
+        emit(9, 0, 2);
+        break;
+    case IR_NEG:
+        emit(1, 0, 0);
+        pushValue(value->a);
+        emit(2, 0, OPR_SUB);
+        break;
+    case IR_ODD:
+        pushValue(value->a);
+        emit(2, 0, OPR_ODD);
+        break;
+    case IR_BINARY:
+    {
+        // strength reduction as in generate()
+        Value *a = &values[value->a], *b = &values[value->b];
+        int shift = 0;
+        if ((value->op == OPR_MUL || value->op == OPR_DIV) && b->kind == IR_CONST)
+            shift = powerOfTwo(b->value);
+        if (shift > 0)
+        {
+            pushValue(value->a);
+            emit(1, 0, shift);
+            emit(2, 0, value->op == OPR_MUL ? OPR_SHL : OPR_SHR);
+        }
+        else if (value->op == OPR_MUL && a->kind == IR_CONST && (shift = powerOfTwo(a->value)) > 0)
+        {
+            pushValue(value->b);
+            emit(1, 0, shift);
+            emit(2, 0, OPR_SHL);
+        }
+        else
+        {
+            pushValue(value->a);
+            pushValue(value->b);
+            emit(2, 0, value->op);
+        }
+        break;
+    }
+    }
+}
+
+void pushValue(int v)
+{
+    if (values[v].kind == IR_CONST)
+        emit(1, 0, values[v].value);
+    else if (values[v].inlined)
+        computeValue(v);
+    else
+        emit(3, 0, values[v].home);
+}
+
+void emitJump(int OP, int target)
+{
+    fixups = arenaGrow(fixups, &fixupCapacity, fixupCount + 1, sizeof(Fixup));
+    fixups[fixupCount].index = currentCodeIndex;
+    fixups[fixupCount++].target = target;
+    emit(OP, 0, 0);
+}
+
+// phi operands into phi homes, all loaded before any is stored
+void emitPhiCopies(int from, int to)
+{
+    int count = 0;
+    for (int phi = blocks[to].phis; phi != -1; phi = values[phi].link)
+    {
+        if (values[phi].kind != IR_PHI)
+            continue;
+        int operand = phiOperand(phi, from, to);
+        if (values[operand].kind != IR_CONST && values[operand].home == values[phi].home)
+            continue;
+        pushValue(operand);
+        order[orderCount + count++] = phi;
+    }
+    while (count > 0)
+        emit(4, 0, values[order[orderCount + --count]].home);
+}
+
+// SSA form for the body of block, optimized and lowered. returns 0 and
+// emits nothing when the body is too big for the liveness sets
+int lowerBody(Node *block)
+{
+    valueCount = 0;
+    blockCount = 0;
+    currentBlock = -1;
+    defKeys = NULL;
+    defValues = NULL;
+    defCapacity = 0;
+    defCount = 0;
+    ssaDepth = level;
+    promoted = arenaGrow(promoted, &promotedCapacity, symbolTableIndex, 1);
+    for (int s = 0; s < symbolTableIndex; s++)
+        promoted[s] = symbol_table[s].kind == 2 && symbol_table[s].level == ssaDepth;
+    markEscaping(block->left);
+
+    startBlock(newBlock(-1));
+    ssaStatement(block->right);
+    blocks[currentBlock].last = valueCount;
+    currentBlock = -1;
+    if ((long long)blockCount * (valueCount / 64 + 1) > (1 << 20))
+    {
+        ssaFallbacks++;
+        return 0;
+    }
+    ssaBodies++;
+
+    removeTrivialPhis();
+    sccp();
+    valueNumbering();
+    removeTrivialPhis();
+    deadStoreElimination();
+    deadCodeElimination();
+    countUses();
+
+    // statements in layout order, and which values are computed in place
+    orderCount = 0;
+    for (int b = 0; b < blockCount; b++)
+    {
+        if (!blocks[b].reachable)
+            continue;
+        blocks[b].statements = orderCount;
+        for (int v = blocks[b].first; v < blocks[b].last; v++)
+        {
+            int kind = values[v].kind;
+            if (values[v].block == b && isStatement(v) && kind != IR_NOP && kind != IR_COPY && kind != IR_CONST)
+            {
+                order = arenaGrow(order, &orderCapacity, orderCount + 1, sizeof(int));
+                order[orderCount++] = v;
+            }
+        }
+        blocks[b].statementCount = orderCount - blocks[b].statements;
+        chooseInlined(b);
+    }
+    // room for the phi copies
+    order = arenaGrow(order, &orderCapacity, orderCount + valueCount + 1, sizeof(int));
+
+    // stored values: phis, entries and values not computed in place
+    int *stored = arenaAlloc(valueCount * sizeof(int) + 1);
+    int storedCount = 0;
+    for (int v = 0; v < valueCount; v++)
+    {
+        Value *value = &values[v];
+        if (value->kind == IR_NOP || !blocks[value->block].reachable)
+            continue;
+        if (value->kind == IR_PHI || value->kind == IR_ENTRY || (producesValue(value) && !value->inlined))
+        {
+            value->index = storedCount;
+            stored[storedCount++] = v;
+        }
+    }
+    liveWords = storedCount / 64 + 1;
+    liveIn = arenaAlloc((size_t)blockCount * liveWords * sizeof(long long));
+    memset(liveIn, 0, (size_t)blockCount * liveWords * sizeof(long long));
+    live = arenaAlloc(liveWords * sizeof(long long));
+    homeLive = arenaAlloc((3 + block->op) * sizeof(int));
+    memset(homeLive, 0, (3 + block->op) * sizeof(int));
+
+    // liveness, backwards until no live in set changes
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int b = blockCount - 1; b >= 0; b--)
+        {
+            if (!blocks[b].reachable)
+                continue;
+            liveAtEnd(b, stored, storedCount);
+            walkBlock(b, 0);
+            forgetLive(stored, storedCount);
+            unsigned long long *in = liveIn + (size_t)b * liveWords;
+            if (memcmp(in, live, liveWords * sizeof(long long)) != 0)
+            {
+                memcpy(in, live, liveWords * sizeof(long long));
+                changed = 1;
+            }
+        }
+    }
+
+    // a value keeps the home of its variable unless it would clobber
+    // another value of it that is still live
+    int evicted = 1;
+    while (evicted)
+    {
+        evicted = 0;
+        for (int b = blockCount - 1; b >= 0; b--)
+        {
+            if (!blocks[b].reachable)
+                continue;
+            liveAtEnd(b, stored, storedCount);
+            evicted += walkBlock(b, 1);
+            forgetLive(stored, storedCount);
+        }
+    }
+
+    // temporaries share frame slots where their live intervals, over the
+    // statements in layout order, do not overlap
+    int temporaries = 0;
+    for (int i = 0; i < storedCount; i++)
+    {
+        if (values[stored[i]].home == -1)
+            values[stored[i]].index = temporaries++;
+    }
+    intervalStart = arenaAlloc(temporaries * sizeof(int) + 1);
+    intervalEnd = arenaAlloc(temporaries * sizeof(int) + 1);
+    for (int t = 0; t < temporaries; t++)
+    {
+        intervalStart[t] = 1 << 30;
+        intervalEnd[t] = -1;
+    }
+    int position = 0;
+    for (int b = 0; b < blockCount; b++)
+    {
+        if (!blocks[b].reachable)
+            continue;
+        blocks[b].top = position++;
+        position += blocks[b].statementCount;
+        blocks[b].bottom = position++;
+    }
+    for (int b = 0; b < blockCount; b++)
+    {
+        BasicBlock *bb = &blocks[b];
+        if (!bb->reachable)
+            continue;
+        unsigned long long *in = liveIn + (size_t)b * liveWords;
+        for (int i = 0; i < storedCount; i++)
+        {
+            int v = stored[i];
+            if (values[v].home != -1)
+                continue;
+            // liveIn bits are still the stored value numbers
+            int bit = i;
+            if (in[bit >> 6] >> (bit & 63) & 1)
+                extend(v, bb->top);
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            int succ = bb->succ[i];
+            if (succ == -1)
+                continue;
+            unsigned long long *out = liveIn + (size_t)succ * liveWords;
+            for (int j = 0; j < storedCount; j++)
+            {
+                if (values[stored[j]].home == -1 && (out[j >> 6] >> (j & 63) & 1))
+                    extend(stored[j], bb->bottom);
+            }
+            for (int phi = blocks[succ].phis; phi != -1; phi = values[phi].link)
+            {
+                if (values[phi].kind != IR_PHI)
+                    continue;
+                int operand = phiOperand(phi, b, succ);
+                if (isStored(operand))
+                    extend(operand, bb->bottom);
+                extend(phi, bb->bottom);
+                extend(phi, blocks[succ].top);
+            }
+        }
+        if (bb->end == END_BRANCH && isStored(bb->cond))
+            extend(bb->cond, bb->bottom);
+        else if (bb->end == END_BRANCH && values[bb->cond].inlined)
+            extendUses(bb->cond, bb->bottom);
+        for (int i = 0; i < bb->statementCount; i++)
+        {
+            int v = order[bb->statements + i];
+            if (values[v].inlined)
+                continue;
+            if (producesValue(&values[v]))
+                extend(v, bb->top + 1 + i);
+            extendUses(v, bb->top + 1 + i);
+        }
+    }
+
+    int *sorted = arenaAlloc(temporaries * sizeof(int) + 1);
+    int *slotEnd = arenaAlloc(temporaries * sizeof(int) + 1);
+    int *slotOf = arenaAlloc(temporaries * sizeof(int) + 1);
+    for (int t = 0; t < temporaries; t++)
+        sorted[t] = t;
+    qsort(sorted, temporaries, sizeof(int), compareStart);
+    int slots = 0;
+    for (int i = 0; i < temporaries; i++)
+    {
+        int t = sorted[i], slot = 0;
+        while (slot < slots && slotEnd[slot] > intervalStart[t])
+            slot++;
+        if (slot == slots)
+            slots++;
+        slotEnd[slot] = intervalEnd[t];
+        slotOf[t] = slot;
+    }
+    for (int i = 0; i < storedCount; i++)
+    {
+        if (values[stored[i]].home == -1)
+            values[stored[i]].home = 3 + block->op + slotOf[values[stored[i]].index];
+    }
+    block->op += slots;
+    ssaTemporaries += slots;
+
+    // code, basic blocks in creation order
+    fixupCount = 0;
+    for (int b = 0; b < blockCount; b++)
+    {
+        BasicBlock *bb = &blocks[b];
+        if (!bb->reachable)
+            continue;
+        bb->address = currentCodeIndex;
+        for (int i = 0; i < bb->statementCount; i++)
+        {
+            int v = order[bb->statements + i];
+            Value *value = &values[v];
+            if (value->inlined)
+                continue;
+            switch (value->kind)
+            {
+            case IR_STORE:
+                pushValue(value->a);
+                // emit STO(L=level difference, M=table[symIdx].addr)
+                emit(4, level - symbol_table[value->value].level, symbol_table[value->value].addr);
+                break;
+            case IR_WRITE:
+                pushValue(value->a);
+                emit(9, 0, 1);
+                break;
+            case IR_CALL:
+                // emit CAL(L=level difference, M=table[symIdx].addr)
+                emit(5, level - symbol_table[value->value].level, symbol_table[value->value].addr);
+                break;
+            default:
+                computeValue(v);
+                emit(4, 0, value->home);
+                break;
+            }
+        }
+        int next = b + 1;
+        while (next < blockCount && !blocks[next].reachable)
+            next++;
+        if (bb->end == END_JUMP)
+        {
+            emitPhiCopies(b, bb->succ[0]);
+            if (bb->succ[0] != next)
+                emitJump(7, bb->succ[0]);
+        }
+        else if (bb->end == END_BRANCH)
+        {
+            pushValue(bb->cond);
+            emitJump(8, bb->succ[1]);
+            if (bb->succ[0] != next)
+                emitJump(7, bb->succ[0]);
+        }
+    }
+    for (int i = 0; i < fixupCount; i++)
+        code[fixups[i].index].M = blocks[fixups[i].target].address * 3;
+    return 1;
+}
+
+// code generation from the tree, level is the nesting depth of the block
+// being generated and code addresses are in PAS words, three per instruction
+void generate(Node *node)
+{
+    if (node == NULL)
+        return;
+    switch (node->kind)
+    {
+    case NODE_NUMBER:
+        // emit LIT
+        emit(1, 0, node->value);
+        break;
+    case NODE_VAR:
+        if (symbol_table[node->value].kind == 1)
+        {
+            // emit LIT(M=table[symIdx].val), constants are only left when not folding
+            emit(1, 0, symbol_table[node->value].val);
+        }
+        else
+        {
+            // emit LOD(L=level difference, M=table[symIdx].addr)
+            emit(3, level - symbol_table[node->value].level, symbol_table[node->value].addr);
+        }
+        break;
+    case NODE_NEG:
+        // 0 - x, the VM has no negation
+        emit(1, 0, 0);
+        generate(node->left);
+        emit(2, 0, OPR_SUB);
+        break;
+    case NODE_ODD:
+        generate(node->left);
+        emit(2, 0, OPR_ODD);
+        break;
+    case NODE_BINARY:
+    {
+        // strength reduction: multiplying or dividing by a power of two is a shift
+        int shift = 0;
+        if ((node->op == OPR_MUL || node->op == OPR_DIV) && node->right->kind == NODE_NUMBER)
+            shift = powerOfTwo(node->right->value);
+        if (shift > 0)
+        {
+            generate(node->left);
+            emit(1, 0, shift);
+            emit(2, 0, node->op == OPR_MUL ? OPR_SHL : OPR_SHR);
+        }
+        else if (node->op == OPR_MUL && node->left->kind == NODE_NUMBER && (shift = powerOfTwo(node->left->value)) > 0)
+        {
+            generate(node->right);
+            emit(1, 0, shift);
+            emit(2, 0, OPR_SHL);
+        }
+        else
+        {
+            generate(node->left);
+            generate(node->right);
+            emit(2, 0, node->op);
+        }
+        break;
+    }
+    case NODE_ASSIGN:
+        generate(node->left);
+        // emit STO(L=level difference, M=table[symIdx].addr)
+        emit(4, level - symbol_table[node->value].level, symbol_table[node->value].addr);
+        break;
+    case NODE_CALL:
+        // emit CAL(L=level difference, M=table[symIdx].addr)
+        emit(5, level - symbol_table[node->value].level, symbol_table[node->value].addr);
+        break;
+    case NODE_BEGIN:
+        for (Node *child = node->left; child != NULL; child = child->next)
+            generate(child);
+        break;
+    case NODE_IF:
+    {
+        generate(node->left);
+        int jpcIdx = currentCodeIndex;
+        // emit JPC
+        emit(8, 0, 0);
+        generate(node->right);
+        if (node->third != NULL)
+        {
+            int jmpIdx = currentCodeIndex;
+            // emit JMP over the else branch
+            emit(7, 0, 0);
+            code[jpcIdx].M = currentCodeIndex * 3;
+            generate(node->third);
+            code[jmpIdx].M = currentCodeIndex * 3;
+        }
+        else
+            code[jpcIdx].M = currentCodeIndex * 3;
+        break;
+    }
+    case NODE_WHILE:
+    {
+        int loopIdx = currentCodeIndex;
+        generate(node->left);
+        int jpcIdx = currentCodeIndex;
+        // emit JPC
+        emit(8, 0, 0);
+        generate(node->right);
+        // emit JMP(M=loopIdx)
+        emit(7, 0, loopIdx * 3);
+        code[jpcIdx].M = currentCodeIndex * 3;
+        break;
+    }
+    case NODE_READ:
+        // emit READ
+        emit(9, 0, 2);
+        // emit STO(L=level difference, M=table[symIdx].addr)
+        emit(4, level - symbol_table[node->value].level, symbol_table[node->value].addr);
+        break;
+    case NODE_WRITE:
+        generate(node->left);
+        // emit WRITE
+        emit(9, 0, 1);
+        break;
+    case NODE_BLOCK:
+    {
+        int procIdx = node->value;
+        int jmpIdx = currentCodeIndex;
+        // calls from nested procedures go through the JMP until the INC is known
+        if (procIdx != -1)
+            symbol_table[procIdx].addr = jmpIdx * 3;
+        // emit JMP over nested procedures
+        emit(7, 0, 0);
+        level++;
+        for (Node *proc = node->left; proc != NULL; proc = proc->next)
+            generate(proc);
+        level--;
+        code[jmpIdx].M = currentCodeIndex * 3;
+        if (procIdx != -1)
+            symbol_table[procIdx].addr = currentCodeIndex * 3;
+        int incIdx = currentCodeIndex;
+        emit(6, 0, 3 + node->op);
+        if (!ssaEnabled || !lowerBody(node))
+            generate(node->right);
+        // lowering may have added temporaries to the frame
+        code[incIdx].M = 3 + node->op;
+        if (procIdx != -1)
+        {
+            // emit RTN
+            emit(2, 0, OPR_RTN);
+        }
+        break;
+    }
+    }
+}
+
+// C backend, --emit-c=<file>: the tree as a C translation unit. each block
+// becomes a function, main() for the main block, and its variables C locals,
+// except those a nested procedure uses, which go in a frame struct that also
+// links to the frame of the enclosing block. arithmetic wraps at 32 bits like
+// the vm's and read and write print what the vm prints, so gcc -O2 builds a
+// native binary with the program's output
+enum
+{
+    C_UP_LEVEL = 1, // used by a nested procedure
+    C_IN_FRAME = 2,
+    C_LOCAL = 4
+};
+
+FILE *cOutput;
+char *cState;
+
+const char *cPrelude =
+    "#include <stdio.h>\n"
+    "\n"
+    "// 32 bit wrapping arithmetic, as the vm does it\n"
+    "static inline int add(int a, int b) { return (int)((unsigned)a + (unsigned)b); }\n"
+    "static inline int sub(int a, int b) { return (int)((unsigned)a - (unsigned)b); }\n"
+    "static inline int mul(int a, int b) { return (int)((unsigned)a * (unsigned)b); }\n"
+    "static inline int shl(int a, int b) { return (int)((unsigned)a << (b & 31)); }\n"
+    "static inline int shr(int a, int b) { b &= 31; return (a + ((a >> 31) & (int)((1u << b) - 1))) >> b; }\n"
+    "\n"
+    "static int readInteger(void)\n"
+    "{\n"
+    "    int value = 0;\n"
+    "    printf(\"Please Enter an integer: \");\n"
+    "    if (scanf(\"%d\", &value) != 1)\n"
+    "        value = 0;\n"
+    "    return value;\n"
+    "}\n"
+    "\n"
+    "static void writeInteger(int value)\n"
+    "{\n"
+    "    printf(\"Output result is: %d\\n\", value);\n"
+    "}\n"
+    "\n";
+
+// PL/0 names with the symbol number appended, unique and never a C keyword
+void cName(int symbol)
+{
+    char *text = nameText(symbol_table[symbol].name);
+    fprintf(cOutput, "%s_%d", text[0] == '$' ? text + 1 : text, symbol);
+}
+
+void cFrameType(Node *block)
+{
+    fprintf(cOutput, "struct frame_");
+    if (block->value == -1)
+        fprintf(cOutput, "main");
+    else
+        cName(block->value);
+}
+
+void cIndent(int indent)
+{
+    fprintf(cOutput, "%*s", indent * 4, "");
+}
+
+void cMarkUpLevel(Node *node, int depth)
+{
+    if (node == NULL)
+        return;
+    if ((node->kind == NODE_VAR || node->kind == NODE_ASSIGN || node->kind == NODE_READ) &&
+        symbol_table[node->value].kind == 2 && symbol_table[node->value].level < depth)
+        cState[node->value] |= C_UP_LEVEL;
+    if (node->kind == NODE_BLOCK)
+    {
+        for (Node *proc = node->left; proc != NULL; proc = proc->next)
+            cMarkUpLevel(proc, depth + 1);
+        cMarkUpLevel(node->right, depth);
+        return;
+    }
+    cMarkUpLevel(node->left, depth);
+    cMarkUpLevel(node->right, depth);
+    cMarkUpLevel(node->third, depth);
+    cMarkUpLevel(node->next, depth);
+}
+
+// declare each variable of the block at depth used in node once, as a frame
+// field or as a local
+void cDeclare(Node *node, int depth, int as)
+{
+    if (node == NULL)
+        return;
+    if ((node->kind == NODE_VAR || node->kind == NODE_ASSIGN || node->kind == NODE_READ) &&
+        symbol_table[node->value].kind == 2 && symbol_table[node->value].level == depth &&
+        !(cState[node->value] & as) && (cState[node->value] & C_UP_LEVEL) == (as == C_IN_FRAME ? C_UP_LEVEL : 0))
+    {
+        cState[node->value] |= as;
+        fprintf(cOutput, "    int ");
+        cName(node->value);
+        fprintf(cOutput, as == C_IN_FRAME ? ";\n" : " = 0;\n");
+    }
+    if (node->kind == NODE_BLOCK)
+    {
+        // only frame fields are used by nested blocks
+        if (as == C_IN_FRAME)
+            for (Node *proc = node->left; proc != NULL; proc = proc->next)
+                cDeclare(proc, depth, as);
+        cDeclare(node->right, depth, as);
+        return;
+    }
+    cDeclare(node->left, depth, as);
+    cDeclare(node->right, depth, as);
+    cDeclare(node->third, depth, as);
+    cDeclare(node->next, depth, as);
+}
+
+// the frame of the block at target depth from code at depth, target < depth
+void cUp(int depth, int target)
+{
+    fprintf(cOutput, "up");
+    for (int d = depth - 1; d > target; d--)
+        fprintf(cOutput, "->up");
+}
+
+void cVariable(int symbol, int depth)
+{
+    int owner = symbol_table[symbol].level;
+    if (owner < depth)
+    {
+        cUp(depth, owner);
+        fprintf(cOutput, "->");
+    }
+    else if (cState[symbol] & C_UP_LEVEL)
+        fprintf(cOutput, "frame.");
+    cName(symbol);
+}
+
+void cExpression(Node *node, int depth)
+{
+    static const char *functions[15] = {[OPR_ADD] = "add", [OPR_SUB] = "sub", [OPR_MUL] = "mul", [OPR_SHL] = "shl", [OPR_SHR] = "shr"};
+    static const char *operators[15] = {[OPR_DIV] = "/", [OPR_EQL] = "==", [OPR_NEQ] = "!=", [OPR_LSS] = "<", [OPR_LEQ] = "<=",
+                                        [OPR_GTR] = ">", [OPR_GEQ] = ">=", [OPR_AND] = "&"};
+    switch (node->kind)
+    {
+    case NODE_NUMBER:
+        if (node->value == INT_MIN)
+            fprintf(cOutput, "(-2147483647 - 1)");
+        else
+            fprintf(cOutput, node->value < 0 ? "(%d)" : "%d", node->value);
+        break;
+    case NODE_VAR:
+        if (symbol_table[node->value].kind == 1)
+            fprintf(cOutput, symbol_table[node->value].val < 0 ? "(%d)" : "%d", symbol_table[node->value].val);
+        else
+            cVariable(node->value, depth);
+        break;
+    case NODE_NEG:
+        fprintf(cOutput, "sub(0, ");
+        cExpression(node->left, depth);
+        fprintf(cOutput, ")");
+        break;
+    case NODE_ODD:
+        fprintf(cOutput, "(");
+        cExpression(node->left, depth);
+        fprintf(cOutput, " %% 2)");
+        break;
+    case NODE_BINARY:
+        if (functions[node->op] != NULL)
+        {
+            fprintf(cOutput, "%s(", functions[node->op]);
+            cExpression(node->left, depth);
+            fprintf(cOutput, ", ");
+            cExpression(node->right, depth);
+            fprintf(cOutput, ")");
+        }
+        else
+        {
+            fprintf(cOutput, "(");
+            cExpression(node->left, depth);
+            fprintf(cOutput, " %s ", operators[node->op]);
+            cExpression(node->right, depth);
+            fprintf(cOutput, ")");
+        }
+        break;
+    }
+}
+
+void cStatement(Node *node, int depth, int indent);
+
+// a statement as a braced C block
+void cBraced(Node *node, int depth, int indent)
+{
+    cIndent(indent);
+    fprintf(cOutput, "{\n");
+    cStatement(node, depth, indent + 1);
+    cIndent(indent);
+    fprintf(cOutput, "}\n");
+}
+
+void cStatement(Node *node, int depth, int indent)
+{
+    if (node == NULL)
+        return;
+    switch (node->kind)
+    {
+    case NODE_ASSIGN:
+        cIndent(indent);
+        cVariable(node->value, depth);
+        fprintf(cOutput, " = ");
+        cExpression(node->left, depth);
+        fprintf(cOutput, ";\n");
+        break;
+    case NODE_CALL:
+    {
+        int declared = symbol_table[node->value].level;
+        cIndent(indent);
+        cName(node->value);
+        fprintf(cOutput, "(");
+        if (declared == depth)
+            fprintf(cOutput, "&frame");
+        else
+            cUp(depth, declared);
+        fprintf(cOutput, ");\n");
+        break;
+    }
+    case NODE_BEGIN:
+        for (Node *child = node->left; child != NULL; child = child->next)
+            cStatement(child, depth, indent);
+        break;
+    case NODE_IF:
+        cIndent(indent);
+        fprintf(cOutput, "if (");
+        cExpression(node->left, depth);
+        fprintf(cOutput, ")\n");
+        cBraced(node->right, depth, indent);
+        if (node->third != NULL)
+        {
+            cIndent(indent);
+            fprintf(cOutput, "else\n");
+            cBraced(node->third, depth, indent);
+        }
+        break;
+    case NODE_WHILE:
+        cIndent(indent);
+        fprintf(cOutput, "while (");
+        cExpression(node->left, depth);
+        fprintf(cOutput, ")\n");
+        cBraced(node->right, depth, indent);
+        break;
+    case NODE_READ:
+        cIndent(indent);
+        cVariable(node->value, depth);
+        fprintf(cOutput, " = readInteger();\n");
+        break;
+    case NODE_WRITE:
+        cIndent(indent);
+        fprintf(cOutput, "writeInteger(");
+        cExpression(node->left, depth);
+        fprintf(cOutput, ");\n");
+        break;
+    }
+}
+
+// frame structs and prototypes, enclosing blocks first
+void cDeclarations(Node *block, Node *parent, int depth)
+{
+    if (block->left != NULL)
+    {
+        cFrameType(block);
+        fprintf(cOutput, "\n{\n    ");
+        if (parent == NULL)
+            fprintf(cOutput, "void");
+        else
+            cFrameType(parent);
+        fprintf(cOutput, " *up;\n");
+        cDeclare(block, depth, C_IN_FRAME);
+        fprintf(cOutput, "};\n\n");
+    }
+    if (parent != NULL)
+    {
+        fprintf(cOutput, "void ");
+        cName(block->value);
+        fprintf(cOutput, "(");
+        cFrameType(parent);
+        fprintf(cOutput, " *up);\n\n");
+    }
+    for (Node *proc = block->left; proc != NULL; proc = proc->next)
+        cDeclarations(proc, block, depth + 1);
+}
+
+void cFunctions(Node *block, Node *parent, int depth)
+{
+    for (Node *proc = block->left; proc != NULL; proc = proc->next)
+        cFunctions(proc, block, depth + 1);
+
+    if (parent == NULL)
+        fprintf(cOutput, "int main(void)\n{\n");
+    else
+    {
+        fprintf(cOutput, "void ");
+        cName(block->value);
+        fprintf(cOutput, "(");
+        cFrameType(parent);
+        fprintf(cOutput, " *up)\n{\n");
+    }
+    if (block->left != NULL)
+    {
+        fprintf(cOutput, "    ");
+        cFrameType(block);
+        fprintf(cOutput, parent == NULL ? " frame = {0};\n" : " frame = {up};\n");
+    }
+    cDeclare(block->right, depth, C_LOCAL);
+    cStatement(block->right, depth, 1);
+    if (parent == NULL)
+        fprintf(cOutput, "    return 0;\n");
+    fprintf(cOutput, "}\n\n");
+}
+
+int emitC(Node *root, const char *fileName)
+{
+    cOutput = fopen(fileName, "w");
+    if (cOutput == NULL)
+        return 0;
+    cState = arenaAlloc(symbolTableIndex);
+    memset(cState, 0, symbolTableIndex);
+    cMarkUpLevel(root, 0);
+
+    fprintf(cOutput, "// generated by parser-codegen\n\n%s", cPrelude);
+    cDeclarations(root, NULL, 0);
+    cFunctions(root, NULL, 0);
+    fclose(cOutput);
+    return 1;
+}
+
+// x86-64 backend, --emit-asm=<file>: GNU assembler source for Linux that
+// needs only as and ld, with a small runtime of its own for read and write
+// on top of the read, write and exit system calls. each block becomes a
+// function with rbp frames, the static link in the slot below the saved
+// rbp and the variables below it. expressions are lowered one statement at
+// a time to a list of quads, one temporary each, and the temporaries get
+// registers by linear scan over their live ranges, spilling the one that
+// lives longest to the frame when there are none left. temporaries never
+// live across a statement, so no register is live across a call
+enum
+{
+    ASM_IMMEDIATE,
+    ASM_VARIABLE, // value: frame offset of a variable of this block
+    ASM_TEMPORARY // value: quad that computes it
+};
+
+enum
+{
+    QUAD_BINARY,
+    QUAD_NEG,
+    QUAD_ODD,
+    QUAD_LOAD // variable of an enclosing block
+};
+
+typedef struct
+{
+    int kind;
+    int value;
+} Operand;
+
+typedef struct
+{
+    int kind;
+    int op;     // OPR number of a binary
+    int symbol; // variable of a load
+    Operand a;
+    Operand b;
+} Quad;
+
+#define ASM_REGISTERS 6
+
+// eax, ecx and edx are scratch for the instructions of a quad
+const char *asmRegisters[ASM_REGISTERS] = {"esi", "edi", "r8d", "r9d", "r10d", "r11d"};
+
+FILE *asmOutput; // NULL while sizing a frame
+Quad *quads = NULL;
+int quadCount, quadCapacity;
+int *quadEnd = NULL; // last quad (or quadCount for the statement) reading each temporary
+int *quadLocation = NULL; // register, or -1 - spill slot
+int quadEndCapacity, quadLocationCapacity;
+int asmDepth;     // depth of the block being emitted
+int asmSpills;    // spill slots its frame needs
+int asmSpillBase; // frame offset of the spill slots
+int asmLabels;
+
+const char *asmRuntime =
+    "    .intel_syntax noprefix\n"
+    "    .text\n"
+    "    .globl _start\n"
+    "_start:\n"
+    "    call pl0_main\n"
+    "    call pl0_flush\n"
+    "    mov eax, 60\n"
+    "    xor edi, edi\n"
+    "    syscall\n"
+    "\n"
+    "# append edx bytes at rsi to the output buffer\n"
+    "pl0_put:\n"
+    "    mov eax, DWORD PTR [rip + pl0_outlen]\n"
+    "    add eax, edx\n"
+    "    cmp eax, 4096\n"
+    "    jbe 1f\n"
+    "    push rsi\n"
+    "    push rdx\n"
+    "    call pl0_flush\n"
+    "    pop rdx\n"
+    "    pop rsi\n"
+    "1:  mov eax, DWORD PTR [rip + pl0_outlen]\n"
+    "    lea rdi, [rip + pl0_out]\n"
+    "    add rdi, rax\n"
+    "    mov ecx, edx\n"
+    "    rep movsb\n"
+    "    add DWORD PTR [rip + pl0_outlen], edx\n"
+    "    ret\n"
+    "\n"
+    "pl0_flush:\n"
+    "    mov edx, DWORD PTR [rip + pl0_outlen]\n"
+    "    lea rsi, [rip + pl0_out]\n"
+    "1:  test edx, edx\n"
+    "    jz 2f\n"
+    "    mov edi, 1\n"
+    "    mov eax, 1\n"
+    "    syscall\n"
+    "    test rax, rax\n"
+    "    jle 2f\n"
+    "    add rsi, rax\n"
+    "    sub edx, eax\n"
+    "    jmp 1b\n"
+    "2:  mov DWORD PTR [rip + pl0_outlen], 0\n"
+    "    ret\n"
+    "\n"
+    "# SYS 0 1: edi is printed as the vm prints it\n"
+    "pl0_write:\n"
+    "    mov r8d, edi\n"
+    "    lea rsi, [rip + pl0_output_text]\n"
+    "    mov edx, 18\n"
+    "    call pl0_put\n"
+    "    lea r9, [rip + pl0_digits + 15]\n"
+    "    mov BYTE PTR [r9], 10\n"
+    "    mov eax, r8d\n"
+    "    test eax, eax\n"
+    "    jns 1f\n"
+    "    neg eax\n"
+    "1:  mov ecx, 10\n"
+    "2:  xor edx, edx\n"
+    "    div ecx\n"
+    "    add dl, '0'\n"
+    "    dec r9\n"
+    "    mov BYTE PTR [r9], dl\n"
+    "    test eax, eax\n"
+    "    jnz 2b\n"
+    "    test r8d, r8d\n"
+    "    jns 3f\n"
+    "    dec r9\n"
+    "    mov BYTE PTR [r9], '-'\n"
+    "3:  mov rsi, r9\n"
+    "    lea rdx, [rip + pl0_digits + 16]\n"
+    "    sub rdx, r9\n"
+    "    jmp pl0_put\n"
+    "\n"
+    "# next input byte in eax, -1 at end of input\n"
+    "pl0_getc:\n"
+    "    mov ecx, DWORD PTR [rip + pl0_inpos]\n"
+    "    cmp ecx, DWORD PTR [rip + pl0_inlen]\n"
+    "    jb 2f\n"
+    "    xor eax, eax\n"
+    "    xor edi, edi\n"
+    "    lea rsi, [rip + pl0_in]\n"
+    "    mov edx, 4096\n"
+    "    syscall\n"
+    "    test rax, rax\n"
+    "    jg 1f\n"
+    "    mov eax, -1\n"
+    "    ret\n"
+    "1:  mov DWORD PTR [rip + pl0_inlen], eax\n"
+    "    xor ecx, ecx\n"
+    "2:  lea rsi, [rip + pl0_in]\n"
+    "    movzx eax, BYTE PTR [rsi + rcx]\n"
+    "    inc ecx\n"
+    "    mov DWORD PTR [rip + pl0_inpos], ecx\n"
+    "    ret\n"
+    "\n"
+    "# SYS 0 2: the prompt, then a decimal number like scanf's %d in eax,\n"
+    "# 0 when there is none\n"
+    "pl0_read:\n"
+    "    lea rsi, [rip + pl0_prompt]\n"
+    "    mov edx, 25\n"
+    "    call pl0_put\n"
+    "    call pl0_flush\n"
+    "1:  call pl0_getc\n"
+    "    cmp eax, ' '\n"
+    "    je 1b\n"
+    "    lea ecx, [rax - 9]\n"
+    "    cmp ecx, 4\n"
+    "    jbe 1b\n"
+    "    xor r8d, r8d\n"
+    "    cmp eax, '-'\n"
+    "    jne 2f\n"
+    "    mov r8d, 1\n"
+    "    call pl0_getc\n"
+    "    jmp 3f\n"
+    "2:  cmp eax, '+'\n"
+    "    jne 3f\n"
+    "    call pl0_getc\n"
+    "3:  xor r9d, r9d\n"
+    "    xor r10d, r10d\n"
+    "4:  lea ecx, [rax - '0']\n"
+    "    cmp ecx, 9\n"
+    "    ja 5f\n"
+    "    imul r9d, r9d, 10\n"
+    "    add r9d, ecx\n"
+    "    inc r10d\n"
+    "    call pl0_getc\n"
+    "    jmp 4b\n"
+    "5:  cmp eax, -1\n"
+    "    je 6f\n"
+    "    dec DWORD PTR [rip + pl0_inpos]\n"
+    "6:  mov eax, r9d\n"
+    "    test r8d, r8d\n"
+    "    jz 7f\n"
+    "    neg eax\n"
+    "7:  test r10d, r10d\n"
+    "    jnz 8f\n"
+    "    xor eax, eax\n"
+    "8:  ret\n"
+    "\n"
+    "    .section .rodata\n"
+    "pl0_output_text:\n"
+    "    .ascii \"Output result is: \"\n"
+    "pl0_prompt:\n"
+    "    .ascii \"Please Enter an integer: \"\n"
+    "\n"
+    "    .bss\n"
+    "pl0_out:\n"
+    "    .zero 4096\n"
+    "pl0_in:\n"
+    "    .zero 4096\n"
+    "pl0_digits:\n"
+    "    .zero 16\n"
+    "pl0_outlen:\n"
+    "    .zero 4\n"
+    "pl0_inlen:\n"
+    "    .zero 4\n"
+    "pl0_inpos:\n"
+    "    .zero 4\n"
+    "\n"
+    "    .text\n";
+
+void asmLine(const char *format, ...)
+{
+    if (asmOutput == NULL)
+        return;
+    va_list args;
+    va_start(args, format);
+    fprintf(asmOutput, "    ");
+    vfprintf(asmOutput, format, args);
+    fprintf(asmOutput, "\n");
+    va_end(args);
+}
+
+int asmVariableOffset(int symbol)
+{
+    return 8 + 4 * (symbol_table[symbol].addr - 2);
+}
+
+void asmUse(Operand operand, int position)
+{
+    if (operand.kind == ASM_TEMPORARY)
+        quadEnd[operand.value] = position;
+}
+
+Operand asmQuad(int kind, int op, int symbol, Operand a, Operand b)
+{
+    quads = arenaGrow(quads, &quadCapacity, quadCount + 1, sizeof(Quad));
+    quadEnd = arenaGrow(quadEnd, &quadEndCapacity, quadCount + 1, sizeof(int));
+    quadLocation = arenaGrow(quadLocation, &quadLocationCapacity, quadCount + 1, sizeof(int));
+    Quad *quad = &quads[quadCount];
+    quad->kind = kind;
+    quad->op = op;
+    quad->symbol = symbol;
+    quad->a = a;
+    quad->b = b;
+    quadEnd[quadCount] = quadCount;
+    asmUse(a, quadCount);
+    asmUse(b, quadCount);
+    Operand result = {ASM_TEMPORARY, quadCount++};
+    return result;
+}
+
+Operand asmLower(Node *node)
+{
+    Operand result = {ASM_IMMEDIATE, 0}, none = {ASM_IMMEDIATE, 0};
+    switch (node->kind)
+    {
+    case NODE_NUMBER:
+        result.value = node->value;
+        break;
+    case NODE_VAR:
+        if (symbol_table[node->value].kind == 1)
+            result.value = symbol_table[node->value].val;
+        else if (symbol_table[node->value].level == asmDepth)
+        {
+            result.kind = ASM_VARIABLE;
+            result.value = asmVariableOffset(node->value);
+        }
+        else
+            result = asmQuad(QUAD_LOAD, 0, node->value, none, none);
+        break;
+    case NODE_NEG:
+        result = asmQuad(QUAD_NEG, 0, 0, asmLower(node->left), none);
+        break;
+    case NODE_ODD:
+        result = asmQuad(QUAD_ODD, 0, 0, asmLower(node->left), none);
+        break;
+    case NODE_BINARY:
+    {
+        Operand a = asmLower(node->left);
+        Operand b = asmLower(node->right);
+        result = asmQuad(QUAD_BINARY, node->op, 0, a, b);
+        break;
+    }
+    }
+    return result;
+}
+
+// linear scan over the temporaries, which are already in order of their
+// start. a range ending where another starts can share its register, the
+// operands of a quad are read before its result is written
+void asmAllocate()
+{
+    int active[ASM_REGISTERS];
+    int spills = 0;
+    for (int r = 0; r < ASM_REGISTERS; r++)
+        active[r] = -1;
+    for (int t = 0; t < quadCount; t++)
+    {
+        int free = -1, furthest = -1;
+        for (int r = 0; r < ASM_REGISTERS; r++)
+        {
+            if (active[r] >= 0 && quadEnd[active[r]] <= t)
+                active[r] = -1;
+            if (active[r] < 0 && free < 0)
+                free = r;
+            else if (furthest < 0 || quadEnd[active[r]] > quadEnd[active[furthest]])
+                furthest = r;
+        }
+        if (free >= 0)
+        {
+            quadLocation[t] = free;
+            active[free] = t;
+        }
+        else if (quadEnd[active[furthest]] > quadEnd[t])
+        {
+            quadLocation[active[furthest]] = -1 - spills++;
+            quadLocation[t] = furthest;
+            active[furthest] = t;
+        }
+        else
+            quadLocation[t] = -1 - spills++;
+    }
+    if (spills > asmSpills)
+        asmSpills = spills;
+}
+
+char *asmText(Operand operand, char *buffer)
+{
+    if (operand.kind == ASM_IMMEDIATE)
+        sprintf(buffer, "%d", operand.value);
+    else if (operand.kind == ASM_VARIABLE)
+        sprintf(buffer, "DWORD PTR [rbp-%d]", operand.value);
+    else if (quadLocation[operand.value] >= 0)
+        strcpy(buffer, asmRegisters[quadLocation[operand.value]]);
+    else
+        sprintf(buffer, "DWORD PTR [rbp-%d]", asmSpillBase - 4 * quadLocation[operand.value]);
+    return buffer;
+}
+
+// the frame of the block at target depth in reg, target < asmDepth
+void asmChain(int target, const char *reg)
+{
+    asmLine("mov %s, QWORD PTR [rbp-8]", reg);
+    for (int d = asmDepth - 1; d > target; d--)
+        asmLine("mov %s, QWORD PTR [%s-8]", reg, reg);
+}
+
+void asmEmitQuad(int t)
+{
+    static const char *instructions[15] = {[OPR_ADD] = "add", [OPR_SUB] = "sub", [OPR_AND] = "and"};
+    static const char *conditions[15] = {[OPR_EQL] = "e", [OPR_NEQ] = "ne", [OPR_LSS] = "l", [OPR_LEQ] = "le", [OPR_GTR] = "g", [OPR_GEQ] = "ge"};
+    Quad *quad = &quads[t];
+    Operand result = {ASM_TEMPORARY, t};
+    char a[32], b[32], r[32];
+    asmText(quad->a, a);
+    asmText(quad->b, b);
+    asmText(result, r);
+    int inPlace = quadLocation[t] >= 0 && quad->a.kind == ASM_TEMPORARY && quadLocation[quad->a.value] == quadLocation[t];
+    int shift;
+
+    switch (quad->kind)
+    {
+    case QUAD_LOAD:
+        asmChain(symbol_table[quad->symbol].level, "rax");
+        asmLine("mov eax, DWORD PTR [rax-%d]", asmVariableOffset(quad->symbol));
+        break;
+    case QUAD_NEG:
+        if (inPlace)
+        {
+            asmLine("neg %s", r);
+            return;
+        }
+        asmLine("mov eax, %s", a);
+        asmLine("neg eax");
+        break;
+    case QUAD_ODD:
+        // the remainder keeps the sign of the operand like the vm's %
+        asmLine("mov eax, %s", a);
+        asmLine("mov edx, eax");
+        asmLine("shr edx, 31");
+        asmLine("add eax, edx");
+        asmLine("and eax, 1");
+        asmLine("sub eax, edx");
+        break;
+    case QUAD_BINARY:
+        if (instructions[quad->op] != NULL && inPlace)
+        {
+            asmLine("%s %s, %s", instructions[quad->op], r, b);
+            return;
+        }
+        asmLine("mov eax, %s", a);
+        switch (quad->op)
+        {
+        case OPR_ADD:
+        case OPR_SUB:
+        case OPR_AND:
+            asmLine("%s eax, %s", instructions[quad->op], b);
+            break;
+        case OPR_MUL:
+            if (quad->b.kind == ASM_IMMEDIATE && (shift = powerOfTwo(quad->b.value)) > 0)
+                asmLine("shl eax, %d", shift);
+            else if (quad->b.kind == ASM_IMMEDIATE)
+                asmLine("imul eax, eax, %s", b);
+            else
+                asmLine("imul eax, %s", b);
+            break;
+        case OPR_DIV:
+            if (quad->b.kind == ASM_IMMEDIATE && (shift = powerOfTwo(quad->b.value)) > 0)
+            {
+                // toward zero: negative dividends are biased by 2^shift - 1
+                asmLine("mov edx, eax");
+                asmLine("sar edx, 31");
+                asmLine("shr edx, %d", 32 - shift);
+                asmLine("add eax, edx");
+                asmLine("sar eax, %d", shift);
+                break;
+            }
+            asmLine("cdq");
+            if (quad->b.kind == ASM_IMMEDIATE)
+            {
+                asmLine("mov ecx, %s", b);
+                asmLine("idiv ecx");
+            }
+            else
+                asmLine("idiv %s", b);
+            break;
+        case OPR_SHL:
+            asmLine("mov ecx, %s", b);
+            asmLine("shl eax, cl");
+            break;
+        case OPR_SHR:
+            asmLine("mov ecx, %s", b);
+            asmLine("mov edx, 1");
+            asmLine("shl edx, cl");
+            asmLine("dec edx");
+            asmLine("test eax, eax");
+            asmLine("jns 1f");
+            asmLine("add eax, edx");
+            if (asmOutput != NULL)
+                fprintf(asmOutput, "1:\n");
+            asmLine("sar eax, cl");
+            break;
+        default:
+            asmLine("cmp eax, %s", b);
+            asmLine("set%s al", conditions[quad->op]);
+            asmLine("movzx eax, al");
+            break;
+        }
+        break;
+    }
+    asmLine("mov %s, eax", r);
+}
+
+// the quads of the statement, with root read at its end
+void asmEmitQuads(Operand root)
+{
+    asmUse(root, quadCount);
+    asmAllocate();
+    for (int t = 0; t < quadCount; t++)
+        asmEmitQuad(t);
+}
+
+// eax into a variable
+void asmStoreEax(int symbol)
+{
+    int offset = asmVariableOffset(symbol);
+    if (symbol_table[symbol].level == asmDepth)
+        asmLine("mov DWORD PTR [rbp-%d], eax", offset);
+    else
+    {
+        asmChain(symbol_table[symbol].level, "rdx");
+        asmLine("mov DWORD PTR [rdx-%d], eax", offset);
+    }
+}
+
+// jump to label when the condition is whenTrue
+void asmBranch(Node *condition, int whenTrue, int label)
+{
+    static const char *conditions[15] = {[OPR_EQL] = "e", [OPR_NEQ] = "ne", [OPR_LSS] = "l", [OPR_LEQ] = "le", [OPR_GTR] = "g", [OPR_GEQ] = "ge"};
+    static const char *inverses[15] = {[OPR_EQL] = "ne", [OPR_NEQ] = "e", [OPR_LSS] = "ge", [OPR_LEQ] = "g", [OPR_GTR] = "le", [OPR_GEQ] = "l"};
+    char a[32], b[32];
+    quadCount = 0;
+    if (condition->kind == NODE_BINARY && condition->op >= OPR_EQL && condition->op <= OPR_GEQ)
+    {
+        // compare and jump, without the 0 or 1
+        Operand left = asmLower(condition->left);
+        Operand right = asmLower(condition->right);
+        asmUse(left, quadCount);
+        asmEmitQuads(right);
+        asmLine("mov eax, %s", asmText(left, a));
+        asmLine("cmp eax, %s", asmText(right, b));
+        asmLine("j%s .L%d", whenTrue ? conditions[condition->op] : inverses[condition->op], label);
+        return;
+    }
+    Operand value = asmLower(condition);
+    asmEmitQuads(value);
+    asmLine("mov eax, %s", asmText(value, a));
+    asmLine("test eax, eax");
+    asmLine("j%s .L%d", whenTrue ? "nz" : "z", label);
+}
+
+void asmLabel(int label)
+{
+    if (asmOutput != NULL)
+        fprintf(asmOutput, ".L%d:\n", label);
+}
+
+void asmStatement(Node *node)
+{
+    char text[32];
+    if (node == NULL)
+        return;
+    switch (node->kind)
+    {
+    case NODE_ASSIGN:
+    {
+        quadCount = 0;
+        Operand value = asmLower(node->left);
+        asmEmitQuads(value);
+        asmText(value, text);
+        if (symbol_table[node->value].level == asmDepth && (value.kind == ASM_IMMEDIATE || (value.kind == ASM_TEMPORARY && quadLocation[value.value] >= 0)))
+            asmLine("mov DWORD PTR [rbp-%d], %s", asmVariableOffset(node->value), text);
+        else
+        {
+            asmLine("mov eax, %s", text);
+            asmStoreEax(node->value);
+        }
+        break;
+    }
+    case NODE_CALL:
+    {
+        // the static link is the frame of the block declaring the procedure
+        int declared = symbol_table[node->value].level;
+        if (declared == asmDepth)
+            asmLine("mov rdi, rbp");
+        else
+            asmChain(declared, "rdi");
+        asmLine("call %s_%d", nameText(symbol_table[node->value].name), node->value);
+        break;
+    }
+    case NODE_BEGIN:
+        for (Node *child = node->left; child != NULL; child = child->next)
+            asmStatement(child);
+        break;
+    case NODE_IF:
+    {
+        int elseLabel = asmLabels++;
+        asmBranch(node->left, 0, elseLabel);
+        asmStatement(node->right);
+        if (node->third != NULL)
+        {
+            int endLabel = asmLabels++;
+            asmLine("jmp .L%d", endLabel);
+            asmLabel(elseLabel);
+            asmStatement(node->third);
+            asmLabel(endLabel);
+        }
+        else
+            asmLabel(elseLabel);
+        break;
+    }
+    case NODE_WHILE:
+    {
+        // the condition at the bottom, one jump per iteration
+        int bodyLabel = asmLabels++, conditionLabel = asmLabels++;
+        asmLine("jmp .L%d", conditionLabel);
+        asmLabel(bodyLabel);
+        asmStatement(node->right);
+        asmLabel(conditionLabel);
+        asmBranch(node->left, 1, bodyLabel);
+        break;
+    }
+    case NODE_READ:
+        asmLine("call pl0_read");
+        asmStoreEax(node->value);
+        break;
+    case NODE_WRITE:
+    {
+        quadCount = 0;
+        Operand value = asmLower(node->left);
+        asmEmitQuads(value);
+        asmLine("mov edi, %s", asmText(value, text));
+        asmLine("call pl0_write");
+        break;
+    }
+    }
+}
+
+void asmBlock(Node *block, int depth)
+{
+    for (Node *proc = block->left; proc != NULL; proc = proc->next)
+        asmBlock(proc, depth + 1);
+
+    // a silent pass over the body finds how many spill slots the frame needs
+    FILE *output = asmOutput;
+    int labels = asmLabels;
+    asmDepth = depth;
+    asmSpills = 0;
+    asmOutput = NULL;
+    asmStatement(block->right);
+    asmOutput = output;
+    asmLabels = labels;
+    asmSpillBase = 8 + 4 * block->op;
+    int frame = (asmSpillBase + 4 * asmSpills + 15) & ~15;
+
+    fprintf(asmOutput, "\n");
+    if (block->value == -1)
+        fprintf(asmOutput, "pl0_main:\n");
+    else
+        fprintf(asmOutput, "%s_%d:\n", nameText(symbol_table[block->value].name), block->value);
+    asmLine("push rbp");
+    asmLine("mov rbp, rsp");
+    asmLine("sub rsp, %d", frame);
+    asmLine("mov QWORD PTR [rbp-8], rdi");
+    for (int i = 0; i < block->op; i++)
+        asmLine("mov DWORD PTR [rbp-%d], 0", 12 + 4 * i);
+    asmStatement(block->right);
+    asmLine("leave");
+    asmLine("ret");
+}
+
+int emitAssembly(Node *root, const char *fileName)
+{
+    asmOutput = fopen(fileName, "w");
+    if (asmOutput == NULL)
+        return 0;
+    fprintf(asmOutput, "# generated by parser-codegen, build with: as <file> -o <object> && ld <object>\n");
+    fprintf(asmOutput, "%s", asmRuntime);
+    asmLabels = 0;
+    asmBlock(root, 0);
+    fclose(asmOutput);
+    return 1;
+}
+
+// peephole pass over code[], each rule can be turned off with --peephole=
+//
+//   fold     LIT a, LIT b, OPR op          => LIT (a op b)
+//   algebra  LIT 0, ADD/SUB/SHL/SHR  LIT 1, MUL/DIV => nothing
+//   forward  LIT c, STO x, LOD x           => LIT c, STO x, LIT c
+//            LOD x, STO x                  => nothing
+//   thread   JMP/JPC to a JMP              => straight to its target
+//            JMP to RTN                    => RTN
+//   dead     JMP to the next instruction, LIT c, JPC and code that is
+//            never reached after JMP, RTN and EOP
+//
+// a pattern never spans a jump target except at its first instruction, so
+// jumps into it see the same stack effect. deleted instructions are marked
+// and squeezed out at the end of each round, remapping jump targets and
+// procedure addresses, until a round changes nothing
+enum
+{
+    PEEP_FOLD,
+    PEEP_ALGEBRA,
+    PEEP_FORWARD,
+    PEEP_THREAD,
+    PEEP_DEAD,
+    PEEP_COUNT
+};
+
+char *peepholeNames[PEEP_COUNT] = {"fold", "algebra", "forward", "thread", "dead"};
+int peepholeEnabled[PEEP_COUNT] = {1, 1, 1, 1, 1};
+int peepholeApplied[PEEP_COUNT];
+
+int isJump(INS ins)
+{
+    return ins.OP == 5 || ins.OP == 7 || ins.OP == 8;
+}
+
+int isLIT(INS ins, int value)
+{
+    return ins.OP == 1 && ins.M == value;
+}
+
+int sameVariable(INS a, INS b)
+{
+    return a.L == b.L && a.M == b.M;
+}
+
+// whether control never falls through ins
+int endsFlow(INS ins)
+{
+    return ins.OP == 7 || (ins.OP == 2 && ins.M == OPR_RTN) || (ins.OP == 9 && ins.M == 3);
+}
+
+int peepholeRound(char *target, char *deleted)
+{
+    int changed = 0;
+    int count = currentCodeIndex;
+
+    memset(target, 0, count);
+    memset(deleted, 0, count);
+    target[0] = 1;
+    for (int i = 0; i < count; i++)
+    {
+        if (isJump(code[i]))
+            target[code[i].M / 3] = 1;
+    }
+    for (int i = 0; i < symbolTableIndex; i++)
+    {
+        if (symbol_table[i].kind == 3)
+            target[symbol_table[i].addr / 3] = 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (deleted[i])
+            continue;
+        INS *a = &code[i];
+        INS *b = i + 1 < count && !target[i + 1] ? &code[i + 1] : NULL;
+        INS *c = b != NULL && i + 2 < count && !target[i + 2] ? &code[i + 2] : NULL;
+
+        if (peepholeEnabled[PEEP_FOLD] && a->OP == 1 && b != NULL && b->OP == 1 && c != NULL && c->OP == 2 &&
+            c->M >= OPR_ADD && c->M <= OPR_AND && c->M != OPR_ODD && !(c->M == OPR_DIV && b->M == 0) &&
+            !((c->M == OPR_SHL || c->M == OPR_SHR) && (b->M < 0 || b->M > 30)))
+        {
+            a->M = evaluate(c->M, a->M, b->M);
+            deleted[i + 1] = deleted[i + 2] = 1;
+            peepholeApplied[PEEP_FOLD]++;
+            changed = 1;
+            i += 2;
+        }
+        else if (peepholeEnabled[PEEP_FOLD] && a->OP == 1 && b != NULL && b->OP == 2 && b->M == OPR_ODD)
+        {
+            a->M = a->M % 2;
+            deleted[i + 1] = 1;
+            peepholeApplied[PEEP_FOLD]++;
+            changed = 1;
+            i++;
+        }
+        else if (peepholeEnabled[PEEP_ALGEBRA] && b != NULL && b->OP == 2 &&
+                 ((isLIT(*a, 0) && (b->M == OPR_ADD || b->M == OPR_SUB || b->M == OPR_SHL || b->M == OPR_SHR)) ||
+                  (isLIT(*a, 1) && (b->M == OPR_MUL || b->M == OPR_DIV))))
+        {
+            deleted[i] = deleted[i + 1] = 1;
+            peepholeApplied[PEEP_ALGEBRA]++;
+            changed = 1;
+            i++;
+        }
+        else if (peepholeEnabled[PEEP_FORWARD] && a->OP == 1 && b != NULL && b->OP == 4 && c != NULL && c->OP == 3 &&
+                 sameVariable(*b, *c))
+        {
+            c->OP = 1;
+            c->L = 0;
+            c->M = a->M;
+            peepholeApplied[PEEP_FORWARD]++;
+            changed = 1;
+            i += 2;
+        }
+        else if (peepholeEnabled[PEEP_FORWARD] && a->OP == 3 && b != NULL && b->OP == 4 && sameVariable(*a, *b))
+        {
+            deleted[i] = deleted[i + 1] = 1;
+            peepholeApplied[PEEP_FORWARD]++;
+            changed = 1;
+            i++;
+        }
+        else if (peepholeEnabled[PEEP_DEAD] && a->OP == 1 && b != NULL && b->OP == 8)
+        {
+            // a constant condition: the jump always or never happens
+            if (a->M == 0)
+            {
+                b->OP = 7;
+                deleted[i] = 1;
+            }
+            else
+                deleted[i] = deleted[i + 1] = 1;
+            peepholeApplied[PEEP_DEAD]++;
+            changed = 1;
+            i++;
+        }
+        else if (peepholeEnabled[PEEP_THREAD] && (a->OP == 7 || a->OP == 8))
+        {
+            // follow a chain of JMPs, at most count steps in case of a loop
+            int to = a->M / 3;
+            for (int steps = 0; code[to].OP == 7 && code[to].M / 3 != to && steps < count; steps++)
+                to = code[to].M / 3;
+            if (to * 3 != a->M)
+            {
+                a->M = to * 3;
+                peepholeApplied[PEEP_THREAD]++;
+                changed = 1;
+            }
+            if (a->OP == 7 && code[to].OP == 2 && code[to].M == OPR_RTN)
+            {
+                *a = code[to];
+                peepholeApplied[PEEP_THREAD]++;
+                changed = 1;
+            }
+        }
+
+        if (peepholeEnabled[PEEP_DEAD] && !deleted[i])
+        {
+            if (code[i].OP == 7 && code[i].M / 3 == i + 1)
+            {
+                deleted[i] = 1;
+                peepholeApplied[PEEP_DEAD]++;
+                changed = 1;
+            }
+            else if (endsFlow(code[i]))
+            {
+                // nothing reaches the code up to the next jump target
+                for (int j = i + 1; j < count && !target[j]; j++)
+                {
+                    if (!deleted[j])
+                    {
+                        deleted[j] = 1;
+                        peepholeApplied[PEEP_DEAD]++;
+                        changed = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    if (!changed)
+        return 0;
+
+    // squeeze out deleted instructions, a jump to one goes to the next kept one
+    int *newIndex = arenaAlloc((count + 1) * sizeof(int));
+    int kept = 0;
+    for (int i = 0; i < count; i++)
+    {
+        newIndex[i] = kept;
+        if (!deleted[i])
+            code[kept++] = code[i];
+    }
+    newIndex[count] = kept;
+    for (int i = 0; i < kept; i++)
+    {
+        if (isJump(code[i]))
+            code[i].M = newIndex[code[i].M / 3] * 3;
+    }
+    for (int i = 0; i < symbolTableIndex; i++)
+    {
+        if (symbol_table[i].kind == 3)
+            symbol_table[i].addr = newIndex[symbol_table[i].addr / 3] * 3;
+    }
+    currentCodeIndex = kept;
+    return 1;
+}
+
+void peephole()
+{
+    char *target = arenaAlloc(currentCodeIndex + 1);
+    char *deleted = arenaAlloc(currentCodeIndex + 1);
+    while (peepholeRound(target, deleted))
+        ;
+}
+
+// --peephole=none, all or a comma separated list of rules
+int parsePeephole(const char *list)
+{
+    for (int r = 0; r < PEEP_COUNT; r++)
+        peepholeEnabled[r] = strcmp(list, "all") == 0;
+    if (strcmp(list, "all") == 0 || strcmp(list, "none") == 0)
+        return 1;
+    while (*list)
+    {
+        int length = strcspn(list, ",");
+        int found = 0;
+        for (int r = 0; r < PEEP_COUNT; r++)
+        {
+            if ((int)strlen(peepholeNames[r]) == length && strncmp(list, peepholeNames[r], length) == 0)
+                peepholeEnabled[r] = found = 1;
+        }
+        if (!found)
+            return 0;
+        list += length;
+        if (*list == ',')
+            list++;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int folding = 1;
+    int licm = 1;
+    int stats = 0;
+    char *outputName = NULL;
+    char *cFileName = NULL;
+    char *asmFileName = NULL;
+    while (argc > 2 && argv[1][0] == '-' && argv[1][1] != '\0')
+    {
+        if (strcmp(argv[1], "--no-fold") == 0)
+            folding = 0;
+        else if (strcmp(argv[1], "--no-licm") == 0)
+            licm = 0;
+        else if (strcmp(argv[1], "--no-ssa") == 0)
+            ssaEnabled = 0;
+        else if (strncmp(argv[1], "--inline-threshold=", 19) == 0)
+            inlineThreshold = atoi(argv[1] + 19);
+        else if (strcmp(argv[1], "--stats") == 0)
+            stats = 1;
+        else if (strncmp(argv[1], "--emit-c=", 9) == 0)
+            cFileName = argv[1] + 9;
+        else if (strncmp(argv[1], "--emit-asm=", 11) == 0)
+            asmFileName = argv[1] + 11;
+        else if (strncmp(argv[1], "--peephole=", 11) == 0)
+        {
+            if (!parsePeephole(argv[1] + 11))
+            {
+                printf("Error: Unknown peephole rule in %s\n", argv[1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[1], "-o") == 0 && argc > 3)
+        {
+            outputName = argv[2];
+            argv++;
+            argc--;
+        }
+        else
+            break;
+        argv++;
+        argc--;
+    }
+    if (argc < 2)
+    {
+        printf("Usage: %s [--no-fold] [--no-licm] [--no-ssa] [--inline-threshold=<nodes>] [--peephole=all|none|<rule,...>] [--stats] [--emit-c=<C file>] [--emit-asm=<assembly file>] [-o <code file>] <input | token file | ->\n", argv[0]);
+        printf("       peephole rules: fold, algebra, forward, thread, dead\n");
+        return 1;
+    }
+
+    // tokens are read from a token file written by "lexer -o", or pulled
+    // from the source as the parser asks for them
+    SourceFile file;
+    openSource(&file, argv[1]);
+    if (!openTokenFile(&file))
+        openTokenStream(&file);
+
+    Node *root = program();
+    closeTokenStream();
+    closeSource(&file);
+
+    if (folding)
+        root = fold(root);
+    if (inlineThreshold > 0)
+        root = inlineProcedures(root);
+    if (licm)
+        root = hoistInvariants(root);
+    if (cFileName != NULL && !emitC(root, cFileName))
+    {
+        printf("Error: Could not write C file\n");
+        return 1;
+    }
+    if (asmFileName != NULL && !emitAssembly(root, asmFileName))
+    {
+        printf("Error: Could not write assembly file\n");
+        return 1;
+    }
+    generate(root);
+    // emit EOP
+    emit(9, 0, 3);
+    int generated = currentCodeIndex;
+    peephole();
+
+    // code file for the vm, one "OP L M" instruction per line
+    if (outputName != NULL)
+    {
+        FILE *out = fopen(outputName, "w");
+        if (out == NULL)
+        {
+            printf("Error: Could not write code file\n");
+            return 1;
+        }
+        for (int i = 0; i < currentCodeIndex; i++)
+            fprintf(out, "%d %d %d\n", code[i].OP, code[i].L, code[i].M);
+        fclose(out);
+    }
+
+    // print assembly code
+    printf("Assembly code:\n");
+    printf("Line\tOP\tL\tM\n");
     for (int i = 0; i < currentCodeIndex; i++)
     {
         printf("  %d\t%s\t%d\t%d\n", i, opcodes[code[i].OP - 1], code[i].L, code[i].M);
@@ -819,7 +4221,20 @@ int main(int argc, char *argv[])
     printf("-----------------------------------------------------\n");
     for (int i = 0; i < symbolTableIndex; i++)
     {
-        printf("  %d  | %14s | %5d | %5d | %7d | %4d\n", symbol_table[i].kind, symbol_table[i].name, symbol_table[i].val, symbol_table[i].level, symbol_table[i].addr, symbol_table[i].mark);
+        printf("  %d  | %14s | %5d | %5d | %7d | %4d\n", symbol_table[i].kind, nameText(symbol_table[i].name), symbol_table[i].val, symbol_table[i].level, symbol_table[i].addr, symbol_table[i].mark);
     }
+
+    if (stats)
+    {
+        printf("\nInlining: %d calls inlined, %d procedures dropped\n", inlinedCount, droppedCount);
+        printf("Loop invariants: %d hoisted into %d temporaries\n", hoistedCount, temporaryCount);
+        printf("SSA: %d bodies, %d left to the tree, %d constants, %d branches folded, %d copies, %d redundant, %d dead stores, %d temporaries\n",
+               ssaBodies, ssaFallbacks, sccpFolded, sccpBranches, copiesPropagated, gvnRedundant, deadStores, ssaTemporaries);
+        printf("Peephole: %d instructions generated, %d after\n", generated, currentCodeIndex);
+        for (int r = 0; r < PEEP_COUNT; r++)
+            printf("  %-8s %s %d\n", peepholeNames[r], peepholeEnabled[r] ? "on " : "off", peepholeApplied[r]);
+    }
+
+    resetCompiler();
     return 0;
 }
\ No newline at end of file
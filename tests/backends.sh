@@ -0,0 +1,83 @@
+#!/bin/bash
+# differential check of the compiler backends and the vm engines against
+# vm --trace=none (the switch loop) on the sample programs, all run on the
+# same input. exits non-zero when any output differs
+#
+#   tests/backends.sh [c] [asm] [engines]    (every check by default)
+#
+# only the programs' own output is compared. it is expected to match only
+# for programs that get enough input and read no procedure variable before
+# writing it: what such a read gives depends on the backend, and on the
+# engine for --engine=reg
+cd "$(dirname "$0")/.." || exit 1
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+
+gcc -O2 parser-codegen.c -o "$build/parser-codegen" || exit 1
+gcc -O2 vm.c -o "$build/vm" || exit 1
+
+input="3 4 5 6 7 8 9 10" # more numbers than any program reads
+checks=${*:-c asm engines}
+status=0
+programs=0
+
+# compare <program> <what> <command...>: the command's output against the
+# vm's, saved in <program>.out
+compare()
+{
+    local name=$1 what=$2
+    shift 2
+    echo $input | timeout 10 "$@" > "$build/$name.got"
+    if ! cmp -s "$build/$name.out" "$build/$name.got"; then
+        echo "MISMATCH: $name, $what"
+        diff "$build/$name.out" "$build/$name.got" | head -5
+        status=1
+    fi
+}
+
+for f in inputs/*.txt tests/programs/*.txt; do
+    name=$(basename "$f" .txt)
+    if ! "$build/parser-codegen" -o "$build/$name.code" "$f" > /dev/null; then
+        echo "skip: $f does not compile"
+        continue
+    fi
+    echo $input | timeout 10 "$build/vm" --trace=none "$build/$name.code" > "$build/$name.out"
+    programs=$((programs + 1))
+
+    for check in $checks; do
+        case $check in
+        c)
+            if "$build/parser-codegen" --emit-c="$build/$name.c" "$f" > /dev/null &&
+                gcc -O2 "$build/$name.c" -o "$build/$name-c"; then
+                compare "$name" "--emit-c" "$build/$name-c"
+            else
+                echo "FAIL: $f does not build through --emit-c"
+                status=1
+            fi
+            ;;
+        asm)
+            # assembled and linked with as and ld alone
+            if "$build/parser-codegen" --emit-asm="$build/$name.s" "$f" > /dev/null &&
+                as "$build/$name.s" -o "$build/$name.o" && ld "$build/$name.o" -o "$build/$name-asm"; then
+                compare "$name" "--emit-asm" "$build/$name-asm"
+            else
+                echo "FAIL: $f does not build through --emit-asm"
+                status=1
+            fi
+            ;;
+        engines)
+            # engines that cannot run a program say so on stderr and interpret it
+            for engine in switch threaded display reg jit; do
+                compare "$name" "--engine=$engine" "$build/vm" --engine=$engine --trace=none "$build/$name.code"
+            done
+            ;;
+        *)
+            echo "unknown check $check"
+            exit 2
+            ;;
+        esac
+    done
+done
+
+[ $status -eq 0 ] && echo "$programs programs, same output for: $checks"
+exit $status
@@ -0,0 +1,27 @@
+#!/bin/bash
+# differential check of the parallel lexer against the serial one, exits
+# non-zero on any difference
+#
+#   tests/lexer.sh [inputs]
+#
+# CFLAGS picks the build, e.g. CFLAGS='-g -fsanitize=address,undefined'
+cd "$(dirname "$0")/.." || exit 1
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+
+gcc ${CFLAGS:--O2} lexer.c -o "$build/lexer" -pthread || exit 1
+status=0
+
+# random inputs cut into 2 to 31 chunks, boundaries inside comments and lexemes
+"$build/lexer" --check "${1:-1000}" || status=1
+
+# the sample programs, printed through --threads
+for f in inputs/*.txt; do
+    for n in 2 3 4; do
+        if ! cmp -s <("$build/lexer" "$f") <("$build/lexer" --threads $n "$f"); then
+            echo "MISMATCH: $f with $n threads"
+            status=1
+        fi
+    done
+done
+exit $status
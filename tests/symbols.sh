@@ -0,0 +1,23 @@
+#!/bin/bash
+# the symbol table listing of every program in tests/programs that has an
+# expected one (<program>.sym), exits non-zero when any differs
+#
+#   tests/symbols.sh
+cd "$(dirname "$0")/.." || exit 1
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+
+gcc -O2 parser-codegen.c -o "$build/parser-codegen" || exit 1
+status=0
+
+for expected in tests/programs/*.sym; do
+    f=${expected%.sym}.txt
+    "$build/parser-codegen" -o "$build/out.code" "$f" | sed -n '/^Symbol Table:/,$p' > "$build/out.sym"
+    if ! cmp -s "$expected" "$build/out.sym"; then
+        echo "MISMATCH: $f"
+        diff "$expected" "$build/out.sym" | head -10
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "symbol tables match"
+exit $status
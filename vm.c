@@ -1,6 +1,8 @@
 //Jadyn Coleman
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #define MAX_PAS_SIZE 500
 
@@ -13,7 +15,36 @@ typedef struct
 
 int BP, SP, PC;
 INS IR;
-int PAS[MAX_PAS_SIZE] = {0};
+// two cells past the stack, never written, so the threaded engine can reload
+// the two top cells of an empty stack
+int PAS[MAX_PAS_SIZE + 2] = {0};
+int codeLength; // words loaded by loadProgram
+long executed;
+
+// set by --bench: output is only summed and reads take 0
+int quiet;
+long quietOutput;
+
+// --trace: what is printed after every instruction
+enum
+{
+    TRACE_NONE,
+    TRACE_OPS,  // the instruction and the registers
+    TRACE_FULL  // and the stack
+};
+
+int traceMode = TRACE_FULL;
+FILE *traceOut;                 // text trace, stdout but in --bench
+FILE *traceFile;                // --trace-file: binary trace instead of text
+int traceShadow[MAX_PAS_SIZE];  // memory as the trace file has it so far
+
+#define TRACE_MAGIC 0x54304c50 // "PL0T"
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
 
 // function to load program into PAS
 void loadProgram(const char *filename)
@@ -32,6 +63,7 @@ void loadProgram(const char *filename)
     {
         i += 3;
     }
+    codeLength = i;
 
     fclose(fp);
 }
@@ -47,36 +79,210 @@ int base(int BP, int L)
     return arb;
 }
 
-// Array for printing opcodes
-char *opcodes[10] = {"LIT", "OPR", "LOD", "STO", "CAL",
-                     "INC", "JMP", "JPC", "SYS", "ERR"};
-char *syscodes[3] = {"SOU", "SIN", "EOP"};
-char *operations[12] = {"RTN", "ADD", "SUB", "MUL", "DIV", "EQL", "NEQ", "LSS", "LEQ", "GTR", "GEQ", "ODD"};
-
-int main(int argc, char *argv[])
+// SYS 0 1 and SYS 0 2, shared by the interpreter and translated code
+void writeOutput(int value)
 {
+    if (quiet)
+        quietOutput = quietOutput * 31 + value;
+    else
+        printf("Output result is: %d\n", value);
+}
 
-    if (argc != 2)
+void readInput(int *cell)
+{
+    if (quiet)
     {
-        printf("Usage: %s <input file>\n", argv[0]);
-        return 1;
+        *cell = 0;
+        return;
     }
+    printf("Please Enter an integer: ");
+    scanf("%d", cell);
+}
 
-    // load program into PAS
-    loadProgram(argv[1]);
+// Array for printing opcodes
+char *opcodes[10] = {"LIT", "OPR", "LOD", "STO", "CAL",
+                     "INC", "JMP", "JPC", "SYS", "ERR"};
+char *syscodes[3] = {"SOU", "SIN", "EOP"};
+char *operations[15] = {"RTN", "ADD", "SUB", "MUL", "DIV", "EQL", "NEQ", "LSS", "LEQ", "GTR", "GEQ", "ODD", "SHL", "SHR", "AND"};
 
-    // initialize registers
+void resetRegisters()
+{
     SP = MAX_PAS_SIZE;
     BP = SP - 1;
     PC = 0;
     IR.OP = 0;
     IR.L = 0;
     IR.M = 0;
+}
+
+// print the instruction just executed and the registers
+void printInstruction()
+{
+    char *opCode;
+    if (IR.OP == 9)
+        opCode = syscodes[IR.M - 1];
+    else if (IR.OP == 2)
+        opCode = operations[IR.M];
+    else
+        opCode = opcodes[IR.OP - 1];
+
+    fprintf(traceOut, "  %s %d %-8d", opCode, IR.L, IR.M);
+
+    // print registers
+    fprintf(traceOut, "%-3d     %-3d     %-3d     ", PC, BP, SP);
+}
+
+// print the instruction just executed, the registers and the stack
+void printState()
+{
+    printInstruction();
+
+    // print stack
+    for (int i = MAX_PAS_SIZE - 1; i >= SP; i--)
+    {
+        if (PAS[i] == 499 && PAS[i + 1] != 499)
+            fprintf(traceOut, "| ");
+        fprintf(traceOut, "%d ", PAS[i]);
+    }
+    fprintf(traceOut, "\n");
+}
+
+void printHeader()
+{
+    fprintf(traceOut, "                PC      BP      SP      Stack\n");
+    fprintf(traceOut, "Initial values: %-3d     %-3d     %-3d\n\n", PC, BP, SP);
+}
+
+// the trace file starts with its magic, MAX_PAS_SIZE, the registers and the
+// whole of PAS; a record per instruction then holds IR, the registers after
+// it and the cells it wrote, as a count and address, value pairs
+void startTrace(FILE *fp)
+{
+    int header[5] = {TRACE_MAGIC, MAX_PAS_SIZE, PC, BP, SP};
+    fwrite(header, sizeof(int), 5, fp);
+    fwrite(PAS, sizeof(int), MAX_PAS_SIZE, fp);
+    memcpy(traceShadow, PAS, sizeof(traceShadow));
+    traceFile = fp;
+}
+
+// the cells an instruction writes follow from IR and the registers after it,
+// a store's address from the memory before it
+void recordStep()
+{
+    int record[7 + 2 * 3], written[3], count = 0;
+    switch (IR.OP)
+    {
+    case 1: // LIT
+    case 3: // LOD
+        written[count++] = SP;
+        break;
+
+    case 2: // OPR but RTN
+        if (IR.M >= 1 && IR.M <= 14)
+            written[count++] = SP;
+        break;
+
+    case 4: // STO
+    {
+        int arb = BP;
+        for (int L = IR.L; L > 0 && arb >= 0 && arb < MAX_PAS_SIZE; L--)
+            arb = traceShadow[arb];
+        written[count++] = arb - IR.M;
+        break;
+    }
+
+    case 5: // CAL
+        written[count++] = BP;
+        written[count++] = BP - 1;
+        written[count++] = BP - 2;
+        break;
+
+    case 9: // SIN
+        if (IR.M == 2)
+            written[count++] = SP;
+        break;
+    }
+
+    int n = 7;
+    for (int i = 0; i < count; i++)
+        if (written[i] >= 0 && written[i] < MAX_PAS_SIZE)
+        {
+            traceShadow[written[i]] = PAS[written[i]];
+            record[n++] = written[i];
+            record[n++] = PAS[written[i]];
+        }
+    record[0] = IR.OP;
+    record[1] = IR.L;
+    record[2] = IR.M;
+    record[3] = PC;
+    record[4] = BP;
+    record[5] = SP;
+    record[6] = (n - 7) / 2;
+    fwrite(record, sizeof(int), n, traceFile);
+}
+
+// after every instruction when tracing
+void traceStep()
+{
+    if (traceFile != NULL)
+        recordStep();
+    else if (traceMode == TRACE_OPS)
+    {
+        printInstruction();
+        fputc('\n', traceOut);
+    }
+    else
+        printState();
+}
+
+// --print-trace: the full text trace back from a trace file
+int printTrace(const char *fileName)
+{
+    FILE *fp = fopen(fileName, "rb");
+    if (fp == NULL)
+    {
+        perror("Error opening file\n");
+        return 1;
+    }
+
+    int header[5], record[7 + 2 * 3];
+    if (fread(header, sizeof(int), 5, fp) != 5 || header[0] != TRACE_MAGIC || header[1] != MAX_PAS_SIZE ||
+        fread(PAS, sizeof(int), MAX_PAS_SIZE, fp) != MAX_PAS_SIZE)
+    {
+        fprintf(stderr, "%s is not a trace file of this vm\n", fileName);
+        fclose(fp);
+        return 1;
+    }
+    PC = header[2];
+    BP = header[3];
+    SP = header[4];
+    printHeader();
 
-    // print header and initial values
-    printf("                PC      BP      SP      Stack\n");
-    printf("Initial values: %-3d     %-3d     %-3d\n\n", PC, BP, SP);
+    while (fread(record, sizeof(int), 7, fp) == 7)
+    {
+        int count = record[6];
+        if (count < 0 || count > 3 || fread(record + 7, sizeof(int), 2 * count, fp) != (size_t)(2 * count))
+        {
+            fprintf(stderr, "%s is cut short\n", fileName);
+            break;
+        }
+        for (int i = 0; i < count; i++)
+            PAS[record[7 + 2 * i]] = record[8 + 2 * i];
+        IR.OP = record[0];
+        IR.L = record[1];
+        IR.M = record[2];
+        PC = record[3];
+        BP = record[4];
+        SP = record[5];
+        printState();
+    }
+    fclose(fp);
+    return 0;
+}
 
+// the switch loop, compiled once with and once without the trace
+static ALWAYS_INLINE void interpretLoop(const int trace)
+{
     int EOP = 0;
     while (!EOP)
     {
@@ -86,6 +292,7 @@ int main(int argc, char *argv[])
         IR.L = PAS[PC + 1];
         IR.M = PAS[PC + 2];
         PC += 3;
+        executed++;
 
         // execute
         switch (IR.OP)
@@ -157,6 +364,21 @@ int main(int argc, char *argv[])
                 PAS[SP] = PAS[SP] % 2;
                 break;
 
+            case 12: // SHL
+                PAS[SP + 1] = (int)((unsigned)PAS[SP + 1] << PAS[SP]);
+                SP++;
+                break;
+
+            case 13: // SHR, rounds toward zero like DIV
+                PAS[SP + 1] = (PAS[SP + 1] + ((PAS[SP + 1] >> 31) & ((1 << PAS[SP]) - 1))) >> PAS[SP];
+                SP++;
+                break;
+
+            case 14: // AND
+                PAS[SP + 1] = PAS[SP + 1] & PAS[SP];
+                SP++;
+                break;
+
             default:
                 break;
             }
@@ -196,12 +418,11 @@ int main(int argc, char *argv[])
             switch (IR.M)
             {
             case 1:
-                printf("Output result is: %d\n", PAS[SP++]);
+                writeOutput(PAS[SP++]);
                 break;
 
             case 2:
-                printf("Please Enter an integer: ");
-                scanf("%d", &PAS[--SP]);
+                readInput(&PAS[--SP]);
                 break;
 
             case 3:
@@ -216,28 +437,2101 @@ int main(int argc, char *argv[])
             break;
         }
 
-        // print instruction
-        char *opCode;
-        if (IR.OP == 9)
-            opCode = syscodes[IR.M - 1];
-        else if (IR.OP == 2)
-            opCode = operations[IR.M];
-        else
-            opCode = opcodes[IR.OP - 1];
+        if (trace)
+            traceStep();
+    }
+}
+
+// run from PC until EOP, tracing every instruction when trace is set
+void interpret(int trace)
+{
+    if (trace)
+        interpretLoop(1);
+    else
+        interpretLoop(0);
+}
+
+// threaded engine, --engine=threaded: the program is decoded once into
+// decoded[], OPR flattened into one operation per M, LOD and STO with L = 0
+// apart and jump targets turned into instruction indices. with GCC it
+// dispatches through labels as values, one indirect jump per instruction,
+// elsewhere through a switch. a PC that starts no decoded instruction (a
+// jump or return into the middle of one, running past the code) goes to
+// an exit entry holding it, which hands over to interpret()
+enum
+{
+    T_LIT,
+    T_RTN, // T_RTN + M for OPR M
+    T_ADD,
+    T_SUB,
+    T_MUL,
+    T_DIV,
+    T_EQL,
+    T_NEQ,
+    T_LSS,
+    T_LEQ,
+    T_GTR,
+    T_GEQ,
+    T_ODD,
+    T_SHL,
+    T_SHR,
+    T_AND,
+    T_LOD,
+    T_LOD0,
+    T_STO,
+    T_STO0,
+    T_CAL, // M: instruction index
+    T_INC,
+    T_JMP, // M: instruction index
+    T_JPC, // M: instruction index
+    T_SOU,
+    T_SIN,
+    T_EOP,
+    T_NOP,
+    T_LODD, // L: display level
+    T_STOD, // L: display level
+    T_CALD, // L: level entered, M: instruction index
+    T_RTND, // L: level left
+    T_EXIT  // M: PC to go on from in interpret()
+};
+
+typedef struct
+{
+#if defined(__GNUC__)
+    void *handler;
+#endif
+    int op;
+    int L;
+    int M;
+} Decoded;
+
+// the instructions, the entry past them, exits for bad jump targets and
+// one more exit for a bad return address
+Decoded decoded[2 * (MAX_PAS_SIZE / 3) + 3];
+int decodedCount; // instructions
+
+void setDecoded(int i, int op, int L, int M)
+{
+    decoded[i].op = op;
+    decoded[i].L = L;
+    decoded[i].M = M;
+}
+
+// --engine=display keeps a display, the base of the innermost frame of each
+// lexical level, so up-level LOD and STO are one indexed load instead of a
+// walk down the static links. CAL saves the entry of the level it enters on
+// a side stack and RTN puts it back. the VM code has no levels, so they are
+// inferred at load time by following the code from PC 0 at level 0, a
+// CAL L M from level l entering M at level l - L + 1 inside the procedure L
+// levels out. the display is only used when every instruction gets a single
+// level and procedure, no LOD, STO or CAL reaches past main and every STO
+// lands among the variables of its frame (3 <= M < INC), so no static link
+// can change under it and the display always holds what base() would find
+int levelOf[MAX_PAS_SIZE / 3 + 1], procedureOf[MAX_PAS_SIZE / 3 + 1];
+int parentOf[MAX_PAS_SIZE / 3 + 1], frameOf[MAX_PAS_SIZE / 3 + 1];
+int display[MAX_PAS_SIZE / 3 + 2];
+int savedDisplay[MAX_PAS_SIZE];
+
+// the procedure L levels out from procedure p, -1 past main
+int enclosing(int p, int L)
+{
+    while (L-- > 0 && p >= 0)
+        p = parentOf[p];
+    return p;
+}
 
-        printf("  %s %d %-8d", opCode, IR.L, IR.M);
+int reach(int i, int level, int procedure, int count, int *work, int *top)
+{
+    if (i < 0 || i >= count)
+        return 1;
+    if (levelOf[i] < 0)
+    {
+        levelOf[i] = level;
+        procedureOf[i] = procedure;
+        work[(*top)++] = i;
+        return 1;
+    }
+    return levelOf[i] == level && procedureOf[i] == procedure;
+}
 
-        // print registers
-        printf("%-3d     %-3d     %-3d     ", PC, BP, SP);
+int inferLevels(int count)
+{
+    int work[MAX_PAS_SIZE / 3 + 1], top = 0;
+    for (int i = 0; i < count; i++)
+    {
+        levelOf[i] = -1;
+        parentOf[i] = -2;
+        frameOf[i] = 0;
+    }
+    parentOf[0] = -1;
+    if (!reach(0, 0, 0, count, work, &top))
+        return 0;
 
-        // print stack
-        for (int i = MAX_PAS_SIZE - 1; i >= SP; i--)
+    while (top > 0)
+    {
+        int i = work[--top], op = PAS[3 * i], L = PAS[3 * i + 1], M = PAS[3 * i + 2];
+        int level = levelOf[i], procedure = procedureOf[i], next = 1;
+        if ((op == 3 || op == 4 || op == 5) && (L < 0 || L > level))
+            return 0;
+        if ((op == 2 && M == 0) || (op == 9 && M == 3))
+            next = 0;
+        else if (op == 6)
+        {
+            if (frameOf[procedure] != 0)
+                return 0;
+            frameOf[procedure] = M;
+        }
+        else if (op == 7 || op == 8 || op == 5)
         {
-            if (PAS[i] == 499 && PAS[i + 1] != 499)
-                printf("| ");
-            printf("%d ", PAS[i]);
+            int target = M % 3 == 0 ? M / 3 : -1;
+            if (op == 7)
+                next = 0;
+            if (op == 5 && target >= 0 && target < count)
+            {
+                int parent = enclosing(procedure, L);
+                if (parentOf[target] == -2)
+                    parentOf[target] = parent;
+                if (parentOf[target] != parent || !reach(target, level - L + 1, target, count, work, &top))
+                    return 0;
+            }
+            else if (op != 5 && !reach(target, level, procedure, count, work, &top))
+                return 0;
         }
-        printf("\n");
+        if (next && !reach(i + 1, level, procedure, count, work, &top))
+            return 0;
     }
-    return 0;
-}
\ No newline at end of file
+
+    for (int i = 0; i < count; i++)
+        if (levelOf[i] >= 0 && PAS[3 * i] == 4)
+        {
+            int M = PAS[3 * i + 2];
+            if (M < 3 || M >= frameOf[enclosing(procedureOf[i], PAS[3 * i + 1])])
+                return 0;
+        }
+    return 1;
+}
+
+// decode the program in PAS, with the display when asked and the levels can
+// be inferred; returns whether the display is used
+int decodeProgram(int useDisplay)
+{
+    int count = codeLength / 3, exits = count + 1;
+    if (useDisplay && !inferLevels(count))
+        useDisplay = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int op = PAS[3 * i], L = PAS[3 * i + 1], M = PAS[3 * i + 2];
+        int level = useDisplay ? levelOf[i] : -1;
+        if (level >= 0 && (op == 3 || op == 4) && L > 0)
+        {
+            setDecoded(i, op == 3 ? T_LODD : T_STOD, level - L, M);
+            continue;
+        }
+        if (level >= 0 && op == 2 && M == 0)
+        {
+            setDecoded(i, T_RTND, level, M);
+            continue;
+        }
+        switch (op)
+        {
+        case 1:
+            setDecoded(i, T_LIT, L, M);
+            break;
+        case 2:
+            setDecoded(i, M >= 0 && M <= 14 ? T_RTN + M : T_NOP, L, M);
+            break;
+        case 3:
+            setDecoded(i, L == 0 ? T_LOD0 : T_LOD, L, M);
+            break;
+        case 4:
+            setDecoded(i, L == 0 ? T_STO0 : T_STO, L, M);
+            break;
+        case 5:
+        case 7:
+        case 8:
+            if (M < 0 || M % 3 != 0 || M / 3 >= count)
+            {
+                setDecoded(exits, T_EXIT, 0, M);
+                M = 3 * exits++;
+            }
+            if (level >= 0 && op == 5)
+                setDecoded(i, T_CALD, level - L + 1, M / 3);
+            else
+                setDecoded(i, op == 5 ? T_CAL : op == 7 ? T_JMP : T_JPC, L, M / 3);
+            break;
+        case 6:
+            setDecoded(i, T_INC, L, M);
+            break;
+        case 9:
+            setDecoded(i, M == 1 ? T_SOU : M == 2 ? T_SIN : M == 3 ? T_EOP : T_NOP, L, M);
+            break;
+        default:
+            setDecoded(i, T_NOP, L, M);
+            break;
+        }
+    }
+    setDecoded(count, T_EXIT, 0, 3 * count);
+    setDecoded(2 * count + 2, T_EXIT, 0, 0);
+    decodedCount = count;
+    return useDisplay;
+}
+
+// trace the instruction just run, next being the one after it
+void traceDecoded(Decoded *current, Decoded *next, int sp, int bp)
+{
+    int i = current - decoded;
+    IR.OP = PAS[3 * i];
+    IR.L = PAS[3 * i + 1];
+    IR.M = PAS[3 * i + 2];
+    PC = next->op == T_EXIT ? next->M : (next - decoded) * 3;
+    SP = sp;
+    BP = bp;
+    traceStep();
+}
+
+// handlers trace nothing themselves: with the trace on, every entry's
+// handler is handle_TRACE, which traces the instruction before going on to
+// the real one, so the untraced path has no trace check at all
+#if defined(__GNUC__)
+#define HANDLER(op) handle_##op:
+#define NEXT()                    \
+    do                            \
+    {                             \
+        current = ip++;           \
+        steps++;                  \
+        goto *current->handler;   \
+    } while (0)
+#else
+#define HANDLER(op) case op:
+#define NEXT() goto dispatch
+#endif
+
+// the top cell is kept in tos (PAS[sp]), so expression chains run through a
+// register instead of storing a cell and loading it straight back. the cache
+// is write through: every cell the switch loop writes is still written, as
+// cells below SP are seen again (INC exposes them, a failed read leaves
+// one), so memory and traces match it exactly
+#define POP()             \
+    sp++;                 \
+    tos = PAS[sp]
+
+#define PUSH(value)       \
+    tos = value;          \
+    PAS[--sp] = tos
+
+// reload after SP moved or the top cell may have been written
+#define RELOAD() tos = PAS[sp]
+
+// binary OPR on the two top cells
+#define BINARY(expression)    \
+    nos = PAS[sp + 1];        \
+    tos = expression;         \
+    PAS[++sp] = tos;          \
+    NEXT()
+
+// run the decoded program from PC until EOP
+void threaded(int trace)
+{
+    int count = decodedCount;
+    if (PC < 0 || PC % 3 != 0 || PC / 3 >= count)
+    {
+        interpret(trace);
+        return;
+    }
+
+    Decoded *ip = decoded + PC / 3, *current, *previous = NULL;
+    Decoded *badReturn = &decoded[2 * count + 2];
+    int sp = SP, bp = BP, pc, tos, nos;
+    int *saved = savedDisplay;
+    long steps = 0;
+    display[0] = bp;
+    RELOAD();
+
+#if defined(__GNUC__)
+    static void *handlers[T_EXIT + 1] = {
+        &&handle_T_LIT, &&handle_T_RTN, &&handle_T_ADD, &&handle_T_SUB, &&handle_T_MUL, &&handle_T_DIV,
+        &&handle_T_EQL, &&handle_T_NEQ, &&handle_T_LSS, &&handle_T_LEQ, &&handle_T_GTR, &&handle_T_GEQ,
+        &&handle_T_ODD, &&handle_T_SHL, &&handle_T_SHR, &&handle_T_AND, &&handle_T_LOD, &&handle_T_LOD0,
+        &&handle_T_STO, &&handle_T_STO0, &&handle_T_CAL, &&handle_T_INC, &&handle_T_JMP, &&handle_T_JPC,
+        &&handle_T_SOU, &&handle_T_SIN, &&handle_T_EOP, &&handle_T_NOP,
+        &&handle_T_LODD, &&handle_T_STOD, &&handle_T_CALD, &&handle_T_RTND, &&handle_T_EXIT};
+    for (int i = 0; i < 2 * count + 3; i++)
+        decoded[i].handler = trace ? &&handle_TRACE : handlers[decoded[i].op];
+    NEXT();
+
+handle_TRACE:
+    if (previous != NULL)
+        traceDecoded(previous, current, sp, bp);
+    previous = current;
+    goto *handlers[current->op];
+#else
+dispatch:
+    current = ip++;
+    steps++;
+    if (trace)
+    {
+        if (previous != NULL)
+            traceDecoded(previous, current, sp, bp);
+        previous = current;
+    }
+    switch (current->op)
+    {
+#endif
+
+    HANDLER(T_LIT)
+    PUSH(current->M);
+    NEXT();
+
+    HANDLER(T_RTN)
+    sp = bp + 1;
+    bp = PAS[sp - 2];
+    pc = PAS[sp - 3];
+    RELOAD();
+    if (pc >= 0 && pc % 3 == 0 && pc / 3 < count)
+        ip = decoded + pc / 3;
+    else
+    {
+        badReturn->M = pc;
+        ip = badReturn;
+    }
+    NEXT();
+
+    HANDLER(T_ADD)
+    BINARY(nos + tos);
+
+    HANDLER(T_SUB)
+    BINARY(nos - tos);
+
+    HANDLER(T_MUL)
+    BINARY(nos * tos);
+
+    HANDLER(T_DIV)
+    BINARY(nos / tos);
+
+    HANDLER(T_EQL)
+    BINARY(nos == tos);
+
+    HANDLER(T_NEQ)
+    BINARY(nos != tos);
+
+    HANDLER(T_LSS)
+    BINARY(nos < tos);
+
+    HANDLER(T_LEQ)
+    BINARY(nos <= tos);
+
+    HANDLER(T_GTR)
+    BINARY(nos > tos);
+
+    HANDLER(T_GEQ)
+    BINARY(nos >= tos);
+
+    HANDLER(T_ODD)
+    tos = tos % 2;
+    PAS[sp] = tos;
+    NEXT();
+
+    HANDLER(T_SHL)
+    BINARY((int)((unsigned)nos << tos));
+
+    HANDLER(T_SHR)
+    BINARY((nos + ((nos >> 31) & ((1 << tos) - 1))) >> tos);
+
+    HANDLER(T_AND)
+    BINARY(nos & tos);
+
+    HANDLER(T_LOD)
+    PUSH(PAS[base(bp, current->L) - current->M]);
+    NEXT();
+
+    HANDLER(T_LOD0)
+    PUSH(PAS[bp - current->M]);
+    NEXT();
+
+    HANDLER(T_STO)
+    PAS[base(bp, current->L) - current->M] = tos;
+    sp++;
+    RELOAD();
+    NEXT();
+
+    HANDLER(T_STO0)
+    PAS[bp - current->M] = tos;
+    sp++;
+    RELOAD();
+    NEXT();
+
+    HANDLER(T_CAL)
+    PAS[sp - 1] = base(bp, current->L);
+    PAS[sp - 2] = bp;
+    PAS[sp - 3] = (ip - decoded) * 3;
+    bp = sp - 1;
+    ip = decoded + current->M;
+    NEXT();
+
+    HANDLER(T_LODD)
+    PUSH(PAS[display[current->L] - current->M]);
+    NEXT();
+
+    HANDLER(T_STOD)
+    PAS[display[current->L] - current->M] = tos;
+    sp++;
+    RELOAD();
+    NEXT();
+
+    HANDLER(T_CALD)
+    if (saved == savedDisplay + MAX_PAS_SIZE)
+        goto handover;
+    PAS[sp - 1] = display[current->L - 1];
+    PAS[sp - 2] = bp;
+    PAS[sp - 3] = (ip - decoded) * 3;
+    bp = sp - 1;
+    *saved++ = display[current->L];
+    display[current->L] = bp;
+    ip = decoded + current->M;
+    NEXT();
+
+    HANDLER(T_RTND)
+    if (saved == savedDisplay)
+        goto handover;
+    display[current->L] = *--saved;
+    sp = bp + 1;
+    bp = PAS[sp - 2];
+    pc = PAS[sp - 3];
+    RELOAD();
+    if (pc >= 0 && pc % 3 == 0 && pc / 3 < count)
+        ip = decoded + pc / 3;
+    else
+    {
+        badReturn->M = pc;
+        ip = badReturn;
+    }
+    NEXT();
+
+    HANDLER(T_INC)
+    sp -= current->M;
+    RELOAD();
+    NEXT();
+
+    HANDLER(T_JMP)
+    ip = decoded + current->M;
+    NEXT();
+
+    HANDLER(T_JPC)
+    if (tos == 0)
+        ip = decoded + current->M;
+    POP();
+    NEXT();
+
+    HANDLER(T_SOU)
+    writeOutput(tos);
+    POP();
+    NEXT();
+
+    HANDLER(T_SIN)
+    readInput(&PAS[--sp]);
+    RELOAD();
+    NEXT();
+
+    HANDLER(T_NOP)
+    NEXT();
+
+    HANDLER(T_EOP)
+    if (trace)
+        traceDecoded(current, ip, sp, bp);
+    PC = (ip - decoded) * 3;
+    SP = sp;
+    BP = bp;
+    executed += steps;
+    return;
+
+    HANDLER(T_EXIT)
+    PC = current->M;
+    SP = sp;
+    BP = bp;
+    executed += steps - 1;
+    interpret(trace);
+    return;
+
+handover: // run current in interpret() instead
+    PC = (current - decoded) * 3;
+    SP = sp;
+    BP = bp;
+    executed += steps - 1;
+    interpret(trace);
+    return;
+
+#if !defined(__GNUC__)
+    }
+#endif
+}
+
+// --engine=reg translates the program at load time into three address code
+// for a register machine and runs that. the height of the stack is the same
+// every time an instruction runs, so every cell an instruction touches is a
+// fixed distance below BP: variables are PAS[bp - M], the expression stack at
+// height h is PAS[bp - (h - 1)]. those are the registers, a slot k being
+// PAS[bp - k], and the stack machine's pushes and pops go away: LIT and LOD
+// only note where the value is, an operation reads its operands from there
+// and writes its result to the slot of its stack cell (or straight to the
+// variable a STO puts it in) and a comparison feeding a JPC becomes one
+// compare and branch. values still pending are written to their cells before
+// a label, a jump or a call. the levels and frames inferred for the display
+// tell which programs qualify, and up-level variables go through the
+// display. cells the stack machine writes and never reads again are not
+// written, so only programs that read an uninitialised variable or past the
+// end of input can tell the difference
+#define REG_BINARIES(X)                                                                                       \
+    X(ADD, x + y)                                                                                             \
+    X(SUB, x - y)                                                                                             \
+    X(MUL, x * y)                                                                                             \
+    X(DIV, x / y)                                                                                             \
+    X(EQL, x == y)                                                                                            \
+    X(NEQ, x != y)                                                                                            \
+    X(LSS, x < y)                                                                                             \
+    X(LEQ, x <= y)                                                                                            \
+    X(GTR, x > y)                                                                                             \
+    X(GEQ, x >= y)                                                                                            \
+    X(SHL, (int)((unsigned)x << y))                                                                           \
+    X(SHR, (x + ((x >> 31) & ((1 << y) - 1))) >> y)                                                           \
+    X(AND, x & y)
+
+#define REG_COMPARES(X) \
+    X(EQL, x == y)      \
+    X(NEQ, x != y)      \
+    X(LSS, x < y)       \
+    X(LEQ, x <= y)      \
+    X(GTR, x > y)       \
+    X(GEQ, x >= y)
+
+#define REG_BINARY_ENUM(name, expression) R_##name, R_##name##I,
+#define REG_BRANCH_ENUM(name, expression) R_J##name, R_J##name##I,
+
+// d is the destination slot or the jump target, a and b the operand slots, an
+// I suffix taking b as a constant
+enum
+{
+    R_MOVE,    // slot d = slot a
+    R_MOVEI,   // slot d = b
+    R_LOADUP,  // slot d = PAS[display[a] - b]
+    R_STOREUP, // PAS[display[a] - b] = slot d
+    R_ODD,     // slot d = slot a % 2
+    R_JMP,
+    R_JZ,      // jump if slot a is 0
+    R_CALL,    // a: level entered, b: stack height
+    R_RET,     // a: level left, b: stack height
+    R_WRITE,   // slot a
+    R_WRITEI,  // b
+    R_READ,    // into slot d
+    R_HALT,    // b: stack height
+    REG_BINARIES(REG_BINARY_ENUM)
+    REG_COMPARES(REG_BRANCH_ENUM) // jump unless the comparison holds
+    R_COUNT
+};
+
+typedef struct
+{
+#if defined(__GNUC__)
+    void *handler;
+#endif
+    int op;
+    int d;
+    int a;
+    int b;
+    int at; // the stack instruction it comes from
+} RegIns;
+
+#define REG_SIZE (4 * (MAX_PAS_SIZE / 3) + 8)
+
+RegIns regCode[REG_SIZE];
+int regCount;
+int regEntry[MAX_PAS_SIZE / 3 + 1]; // register code of each label, -1 elsewhere
+long regExecuted;
+
+// where a value on the translation time stack is
+enum
+{
+    IN_CELL,     // its own stack cell
+    IN_SLOT,     // slot value, not copied to its cell yet
+    IN_CONSTANT  // the constant value
+};
+
+typedef struct
+{
+    int kind;
+    int value;
+} Operand;
+
+Operand regStack[MAX_PAS_SIZE + 1]; // by height, 1 the bottom of the frame
+int regHeight;
+int regFresh; // the instruction that computed the top cell just now, or -1
+
+int regEmit(int op, int d, int a, int b, int at)
+{
+    if (regCount == REG_SIZE)
+        return -1;
+    regCode[regCount].op = op;
+    regCode[regCount].d = d;
+    regCode[regCount].a = a;
+    regCode[regCount].b = b;
+    regCode[regCount].at = at;
+    return regCount++;
+}
+
+// write the value at height h to its cell
+void regMaterialize(int h, int at)
+{
+    Operand *operand = &regStack[h];
+    if (operand->kind == IN_CONSTANT)
+        regEmit(R_MOVEI, h - 1, 0, operand->value, at);
+    else if (operand->kind == IN_SLOT && operand->value != h - 1)
+        regEmit(R_MOVE, h - 1, operand->value, 0, at);
+    operand->kind = IN_CELL;
+}
+
+void regFlush(int at)
+{
+    for (int h = 1; h <= regHeight; h++)
+        regMaterialize(h, at);
+    regFresh = -1;
+}
+
+// the slot a value can be read from, written to its cell first if constant
+int regSlot(int h, int at)
+{
+    if (regStack[h].kind == IN_CONSTANT)
+        regMaterialize(h, at);
+    return regStack[h].kind == IN_SLOT ? regStack[h].value : h - 1;
+}
+
+void regPush(int kind, int value)
+{
+    regHeight++;
+    regStack[regHeight].kind = kind;
+    regStack[regHeight].value = value;
+    regFresh = -1;
+}
+
+// the height of the stack at every reachable instruction, following the code
+// as inferLevels did; 0 when it is not always the same or a pop reaches into
+// the frame, or for an instruction the translation has no counterpart for
+int regHeights(int count, int *heightOf, char *label)
+{
+    int work[MAX_PAS_SIZE / 3 + 1], top = 0;
+    for (int i = 0; i < count; i++)
+    {
+        heightOf[i] = -1;
+        label[i] = 0;
+    }
+    heightOf[0] = 0;
+    work[top++] = 0;
+    label[0] = 1;
+
+    while (top > 0)
+    {
+        int i = work[--top], op = PAS[3 * i], L = PAS[3 * i + 1], M = PAS[3 * i + 2];
+        int h = heightOf[i], frame = frameOf[procedureOf[i]], next = i + 1, jump = -1, after = h;
+        switch (op)
+        {
+        case 1: // LIT
+            after = h + 1;
+            break;
+        case 2:
+            if (M == 0)
+                next = -1;
+            else if (M == 11 && h > frame)
+                after = h;
+            else if (M >= 1 && M <= 14 && M != 11 && h >= frame + 2)
+                after = h - 1;
+            else
+                return 0;
+            break;
+        case 3: // LOD
+            if (L == 0 && (M < 0 || M >= frame))
+                return 0;
+            after = h + 1;
+            break;
+        case 4: // STO
+            if (h <= frame)
+                return 0;
+            after = h - 1;
+            break;
+        case 5: // CAL
+            if (M % 3 != 0 || M < 0 || M / 3 >= count)
+                return 0;
+            label[M / 3] = 1;
+            if (i + 1 < count)
+                label[i + 1] = 1;
+            if (heightOf[M / 3] < 0)
+            {
+                heightOf[M / 3] = 0;
+                work[top++] = M / 3;
+            }
+            break;
+        case 6: // INC
+            if (h != 0)
+                return 0;
+            after = M;
+            break;
+        case 7: // JMP
+        case 8: // JPC
+            if (M % 3 != 0 || M < 0 || M / 3 >= count || (op == 8 && h <= frame))
+                return 0;
+            jump = M / 3;
+            label[jump] = 1;
+            if (op == 7)
+                next = -1;
+            else
+                after = h - 1;
+            break;
+        case 9:
+            if (M == 1 && h > frame)
+                after = h - 1;
+            else if (M == 2)
+                after = h + 1;
+            else if (M == 3)
+                next = -1;
+            else
+                return 0;
+            break;
+        default:
+            return 0;
+        }
+        if (after > MAX_PAS_SIZE)
+            return 0;
+
+        int targets[2] = {next, jump};
+        for (int t = 0; t < 2; t++)
+        {
+            int j = targets[t];
+            if (j < 0)
+                continue;
+            if (j >= count)
+                return 0;
+            if (heightOf[j] < 0)
+            {
+                heightOf[j] = after;
+                work[top++] = j;
+            }
+            else if (heightOf[j] != after)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// translate the program in PAS; 0 when it does not qualify
+int regTranslate()
+{
+    int count = codeLength / 3, heightOf[MAX_PAS_SIZE / 3 + 1];
+    char label[MAX_PAS_SIZE / 3 + 1];
+    if (count == 0 || !inferLevels(count) || !regHeights(count, heightOf, label))
+        return 0;
+
+    regCount = 0;
+    regHeight = 0;
+    regFresh = -1;
+    for (int i = 0; i < count; i++)
+    {
+        regEntry[i] = -1;
+        if (heightOf[i] < 0)
+            continue;
+        int op = PAS[3 * i], L = PAS[3 * i + 1], M = PAS[3 * i + 2];
+
+        if (label[i])
+        {
+            regFlush(i);
+            regEntry[i] = regCount;
+            regHeight = heightOf[i];
+            for (int h = 1; h <= regHeight; h++)
+                regStack[h].kind = IN_CELL;
+        }
+
+        switch (op)
+        {
+        case 1: // LIT
+            regPush(IN_CONSTANT, M);
+            break;
+
+        case 2:
+            if (M == 0)
+                regEmit(R_RET, 0, levelOf[i], regHeight, i);
+            else if (M == 11)
+            {
+                int a = regSlot(regHeight, i);
+                regFresh = regEmit(R_ODD, regHeight - 1, a, 0, i);
+                regStack[regHeight].kind = IN_CELL;
+            }
+            else
+            {
+                int k = M <= 10 ? M - 1 : M - 2;
+                int a = regSlot(regHeight - 1, i);
+                Operand *b = &regStack[regHeight];
+                if (b->kind == IN_CONSTANT)
+                    regFresh = regEmit(R_ADD + 2 * k + 1, regHeight - 2, a, b->value, i);
+                else
+                    regFresh = regEmit(R_ADD + 2 * k, regHeight - 2, a, regSlot(regHeight, i), i);
+                regHeight--;
+                regStack[regHeight].kind = IN_CELL;
+            }
+            break;
+
+        case 3: // LOD
+            if (L == 0)
+                regPush(IN_SLOT, M);
+            else
+            {
+                regPush(IN_CELL, 0);
+                regFresh = regEmit(R_LOADUP, regHeight - 1, levelOf[i] - L, M, i);
+            }
+            break;
+
+        case 4: // STO
+        {
+            int pending = 0;
+            for (int h = 1; h < regHeight; h++)
+                if (regStack[h].kind == IN_SLOT && regStack[h].value == M && L == 0)
+                    pending = 1;
+            Operand *value = &regStack[regHeight];
+            if (L > 0)
+                regEmit(R_STOREUP, regSlot(regHeight, i), levelOf[i] - L, M, i);
+            else if (!pending && value->kind == IN_CELL && regFresh == regCount - 1 && regFresh >= 0 &&
+                     regCode[regFresh].d == regHeight - 1)
+                regCode[regFresh].d = M; // compute straight into the variable
+            else
+            {
+                for (int h = 1; h < regHeight; h++)
+                    if (regStack[h].kind == IN_SLOT && regStack[h].value == M)
+                        regMaterialize(h, i);
+                if (value->kind == IN_CONSTANT)
+                    regEmit(R_MOVEI, M, 0, value->value, i);
+                else
+                    regEmit(R_MOVE, M, regSlot(regHeight, i), 0, i);
+            }
+            regHeight--;
+            regFresh = -1;
+            break;
+        }
+
+        case 5: // CAL
+            regFlush(i);
+            regEmit(R_CALL, M / 3, levelOf[i] - L + 1, regHeight, i);
+            break;
+
+        case 6: // INC
+            regHeight = M;
+            for (int h = 1; h <= regHeight; h++)
+                regStack[h].kind = IN_CELL;
+            break;
+
+        case 7: // JMP
+            regFlush(i);
+            regEmit(R_JMP, M / 3, 0, 0, i);
+            break;
+
+        case 8: // JPC
+        {
+            Operand *condition = &regStack[regHeight];
+            if (condition->kind == IN_CELL && regFresh == regCount - 1 && regFresh >= 0 &&
+                regCode[regFresh].op >= R_EQL && regCode[regFresh].op <= R_GEQI)
+            {
+                // the comparison becomes a compare and branch after the flush
+                RegIns compare = regCode[--regCount];
+                regHeight--;
+                regFlush(i);
+                regEmit(compare.op - R_EQL + R_JEQL, M / 3, compare.a, compare.b, compare.at);
+                break;
+            }
+            if (condition->kind == IN_CONSTANT)
+            {
+                int taken = condition->value == 0;
+                regHeight--;
+                regFlush(i);
+                if (taken)
+                    regEmit(R_JMP, M / 3, 0, 0, i);
+                break;
+            }
+            int a = regSlot(regHeight, i);
+            regHeight--;
+            regFlush(i);
+            regEmit(R_JZ, M / 3, a, 0, i);
+            break;
+        }
+
+        case 9:
+            if (M == 1)
+            {
+                if (regStack[regHeight].kind == IN_CONSTANT)
+                    regEmit(R_WRITEI, 0, 0, regStack[regHeight].value, i);
+                else
+                    regEmit(R_WRITE, 0, regSlot(regHeight, i), 0, i);
+                regHeight--;
+                regFresh = -1;
+            }
+            else if (M == 2)
+            {
+                regPush(IN_CELL, 0);
+                regEmit(R_READ, regHeight - 1, 0, 0, i);
+            }
+            else
+                regEmit(R_HALT, 0, 0, regHeight, i);
+            break;
+        }
+        if (regCount >= REG_SIZE - 8)
+            return 0;
+    }
+
+    // jump and call targets from instruction indices to register code
+    for (int r = 0; r < regCount; r++)
+        if (regCode[r].op == R_JMP || regCode[r].op == R_JZ || regCode[r].op == R_CALL || regCode[r].op >= R_JEQL)
+            regCode[r].d = regEntry[regCode[r].d];
+    return 1;
+}
+
+#define SLOT(k) PAS[bp - (k)]
+
+#define REG_BINARY_LABEL(name, expression) &&handle_R_##name, &&handle_R_##name##I,
+#define REG_BRANCH_LABEL(name, expression) &&handle_R_J##name, &&handle_R_J##name##I,
+
+#define REG_BINARY_HANDLER(name, expression) \
+    HANDLER(R_##name)                         \
+    x = SLOT(current->a);                     \
+    y = SLOT(current->b);                     \
+    SLOT(current->d) = expression;            \
+    NEXT();                                   \
+    HANDLER(R_##name##I)                      \
+    x = SLOT(current->a);                     \
+    y = current->b;                           \
+    SLOT(current->d) = expression;            \
+    NEXT();
+
+#define REG_BRANCH_HANDLER(name, expression)  \
+    HANDLER(R_J##name)                        \
+    x = SLOT(current->a);                     \
+    y = SLOT(current->b);                     \
+    if (!(expression))                        \
+        ip = regCode + current->d;            \
+    NEXT();                                   \
+    HANDLER(R_J##name##I)                     \
+    x = SLOT(current->a);                     \
+    y = current->b;                           \
+    if (!(expression))                        \
+        ip = regCode + current->d;            \
+    NEXT();
+
+// run the translated program from the start until EOP
+void regRun()
+{
+    RegIns *ip = regCode + regEntry[0], *current;
+    int bp = BP, sp, pc, x, y;
+    int *saved = savedDisplay;
+    long steps = 0;
+    display[0] = bp;
+
+#if defined(__GNUC__)
+    static void *handlers[R_COUNT] = {
+        &&handle_R_MOVE, &&handle_R_MOVEI, &&handle_R_LOADUP, &&handle_R_STOREUP, &&handle_R_ODD,
+        &&handle_R_JMP, &&handle_R_JZ, &&handle_R_CALL, &&handle_R_RET, &&handle_R_WRITE, &&handle_R_WRITEI,
+        &&handle_R_READ, &&handle_R_HALT, REG_BINARIES(REG_BINARY_LABEL) REG_COMPARES(REG_BRANCH_LABEL)};
+    for (int i = 0; i < regCount; i++)
+        regCode[i].handler = handlers[regCode[i].op];
+    NEXT();
+#else
+dispatch:
+    current = ip++;
+    steps++;
+    switch (current->op)
+    {
+#endif
+
+    HANDLER(R_MOVE)
+    SLOT(current->d) = SLOT(current->a);
+    NEXT();
+
+    HANDLER(R_MOVEI)
+    SLOT(current->d) = current->b;
+    NEXT();
+
+    HANDLER(R_LOADUP)
+    SLOT(current->d) = PAS[display[current->a] - current->b];
+    NEXT();
+
+    HANDLER(R_STOREUP)
+    PAS[display[current->a] - current->b] = SLOT(current->d);
+    NEXT();
+
+    HANDLER(R_ODD)
+    SLOT(current->d) = SLOT(current->a) % 2;
+    NEXT();
+
+    HANDLER(R_JMP)
+    ip = regCode + current->d;
+    NEXT();
+
+    HANDLER(R_JZ)
+    if (SLOT(current->a) == 0)
+        ip = regCode + current->d;
+    NEXT();
+
+    HANDLER(R_CALL)
+    if (saved == savedDisplay + MAX_PAS_SIZE)
+        goto handover;
+    sp = bp + 1 - current->b;
+    PAS[sp - 1] = display[current->a - 1];
+    PAS[sp - 2] = bp;
+    PAS[sp - 3] = (current->at + 1) * 3;
+    bp = sp - 1;
+    *saved++ = display[current->a];
+    display[current->a] = bp;
+    ip = regCode + current->d;
+    NEXT();
+
+    HANDLER(R_RET)
+    if (saved == savedDisplay)
+        goto handover;
+    display[current->a] = *--saved;
+    sp = bp + 1;
+    bp = PAS[sp - 2];
+    pc = PAS[sp - 3];
+    if (pc >= 0 && pc % 3 == 0 && pc / 3 < codeLength / 3 && regEntry[pc / 3] >= 0)
+        ip = regCode + regEntry[pc / 3];
+    else
+    {
+        // a return address the translation has no label for
+        PC = pc;
+        SP = sp;
+        BP = bp;
+        regExecuted += steps;
+        interpret(0);
+        return;
+    }
+    NEXT();
+
+    HANDLER(R_WRITE)
+    writeOutput(SLOT(current->a));
+    NEXT();
+
+    HANDLER(R_WRITEI)
+    writeOutput(current->b);
+    NEXT();
+
+    HANDLER(R_READ)
+    readInput(&SLOT(current->d));
+    NEXT();
+
+    HANDLER(R_HALT)
+    PC = (current->at + 1) * 3;
+    SP = bp + 1 - current->b;
+    BP = bp;
+    regExecuted += steps;
+    return;
+
+handover: // run the stack instruction of current in interpret() instead
+    PC = current->at * 3;
+    SP = bp + 1 - current->b;
+    BP = bp;
+    regExecuted += steps - 1;
+    interpret(0);
+    return;
+
+    REG_BINARIES(REG_BINARY_HANDLER)
+    REG_COMPARES(REG_BRANCH_HANDLER)
+
+#if !defined(__GNUC__)
+    }
+#endif
+}
+
+// --jit translates the loaded program to x86-64 and runs that instead. every
+// cell the interpreter would write is still written to PAS, so memory always
+// matches it; pool registers only keep copies of the top stack cells so they
+// are not loaded again. anything the translation does not cover (a return to
+// a PC that starts no translated instruction, running past the code) leaves
+// the native code with the registers saved and goes on in the interpreter
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (1 << 20)
+#define POOL_SIZE 5
+#define NOT_CACHED (-(1 << 30))
+
+// rbx holds &PAS[0], r12 SP and r13 BP; eax, ecx, edx and r11 are scratch
+enum
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+    R10 = 10,
+    R11 = 11,
+    R12 = 12,
+    R13 = 13
+};
+
+unsigned char *jitCode;
+int jitSize;
+int jitEntry, jitDispatch, jitExit, jitStop; // offsets of the stubs
+void *jitTable[MAX_PAS_SIZE];                // native code for each PC, jitExit where there is none
+int jitLabel[MAX_PAS_SIZE / 3 + 1];
+int jitFixupAt[MAX_PAS_SIZE / 3 + 1], jitFixupTarget[MAX_PAS_SIZE / 3 + 1], jitFixupCount;
+
+// stack cells held by the pool registers, as offsets from r12. SP itself is
+// r12 + jitDepth between the instructions of a straight run, r12 is only
+// brought up to date where control can leave or enter
+int jitPool[POOL_SIZE] = {RSI, RDI, R8, R9, R10};
+int jitCached[POOL_SIZE];
+int jitDepth;
+
+void jitByte(int b)
+{
+    jitCode[jitSize++] = b;
+}
+
+void jitInt(int value)
+{
+    memcpy(jitCode + jitSize, &value, 4);
+    jitSize += 4;
+}
+
+// opcode reg, rm with rm a register, 64 bit when wide
+void jitReg(int wide, int opcode, int reg, int rm)
+{
+    int rex = wide << 3 | (reg >> 3) << 2 | rm >> 3;
+    if (rex)
+        jitByte(0x40 | rex);
+    if (opcode > 0xff)
+        jitByte(opcode >> 8);
+    jitByte(opcode & 0xff);
+    jitByte(0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// opcode reg, [rbx + index * 4 + disp]
+void jitMem(int wide, int opcode, int reg, int index, int disp)
+{
+    int rex = wide << 3 | (reg >> 3) << 2 | (index >> 3) << 1;
+    if (rex)
+        jitByte(0x40 | rex);
+    if (opcode > 0xff)
+        jitByte(opcode >> 8);
+    jitByte(opcode & 0xff);
+    jitByte(0x84 | (reg & 7) << 3);
+    jitByte(0x80 | (index & 7) << 3 | RBX);
+    jitInt(disp);
+}
+
+// mov reg, value
+void jitImm(int reg, int value)
+{
+    if (reg >= 8)
+        jitByte(0x41);
+    jitByte(0xb8 | (reg & 7));
+    jitInt(value);
+}
+
+// mov reg, address (64 bit)
+void jitAddress(int reg, void *address)
+{
+    jitByte(0x48 | reg >> 3);
+    jitByte(0xb8 | (reg & 7));
+    memcpy(jitCode + jitSize, &address, 8);
+    jitSize += 8;
+}
+
+// opcode reg, [global] through rcx
+void jitGlobal(int opcode, int reg, int *global)
+{
+    jitAddress(RCX, global);
+    if (reg >= 8)
+        jitByte(0x44);
+    jitByte(opcode);
+    jitByte((reg & 7) << 3 | RCX);
+}
+
+void jitCall(void *function)
+{
+    jitAddress(RAX, function);
+    jitByte(0xff);
+    jitByte(0xd0);
+}
+
+// rel32 jump to a stub that is already emitted
+void jitJumpBack(int target)
+{
+    jitByte(0xe9);
+    jitInt(target - (jitSize + 4));
+}
+
+// jmp (or jz when conditional) to the instruction at pc, through jitExit
+// when pc does not start one
+void jitJump(int conditional, int pc, int count)
+{
+    if (pc >= 0 && pc % 3 == 0 && pc / 3 < count)
+    {
+        if (conditional)
+        {
+            jitByte(0x0f);
+            jitByte(0x84);
+        }
+        else
+            jitByte(0xe9);
+        jitFixupAt[jitFixupCount] = jitSize;
+        jitFixupTarget[jitFixupCount++] = pc / 3;
+        jitInt(0);
+        return;
+    }
+    if (conditional)
+    {
+        // jnz over the exit
+        jitByte(0x75);
+        jitByte(10);
+    }
+    jitImm(RAX, pc);
+    jitJumpBack(jitExit);
+}
+
+void jitForget(int below)
+{
+    for (int i = 0; i < POOL_SIZE; i++)
+        if (jitCached[i] < below)
+            jitCached[i] = NOT_CACHED;
+}
+
+void jitClear()
+{
+    for (int i = 0; i < POOL_SIZE; i++)
+        jitCached[i] = NOT_CACHED;
+}
+
+// SP -= cells, cached cells above the old SP are stale from here on
+void jitGrow(int cells)
+{
+    jitForget(jitDepth);
+    jitDepth -= cells;
+}
+
+// make r12 the real SP and drop the cache
+void jitSettle()
+{
+    if (jitDepth)
+    {
+        jitReg(1, 0x81, 0, R12);
+        jitInt(jitDepth);
+    }
+    jitDepth = 0;
+    jitClear();
+}
+
+// push reg: written to PAS as the interpreter does, and kept in the pool
+// register that is free or caches the deepest cell
+void jitPush(int reg)
+{
+    jitGrow(1);
+    jitMem(0, 0x89, reg, R12, jitDepth * 4);
+
+    int slot = 0;
+    for (int i = 1; i < POOL_SIZE; i++)
+        if (jitCached[slot] != NOT_CACHED && (jitCached[i] == NOT_CACHED || jitCached[i] > jitCached[slot]))
+            slot = i;
+    jitReg(0, 0x89, reg, jitPool[slot]);
+    jitCached[slot] = jitDepth;
+}
+
+// pool register caching the cell at SP + k, or -1
+int jitCell(int k)
+{
+    for (int i = 0; i < POOL_SIZE; i++)
+        if (jitCached[i] == jitDepth + k)
+            return jitPool[i];
+    return -1;
+}
+
+// opcode reg, cell SP + k, from its pool register when it is cached
+void jitOperand(int opcode, int reg, int k)
+{
+    int cached = jitCell(k);
+    if (cached >= 0)
+        jitReg(0, opcode, reg, cached);
+    else
+        jitMem(0, opcode, reg, R12, (jitDepth + k) * 4);
+}
+
+// register holding base(BP, L), the static chain walked at translation time
+int jitBase(int L)
+{
+    if (L <= 0)
+        return R13;
+    jitMem(0, 0x8b, RDX, R13, 0);
+    while (--L > 0)
+        jitMem(0, 0x8b, RDX, RDX, 0);
+    return RDX;
+}
+
+void jitOperation(int M)
+{
+    // setcc for EQL to GEQ
+    static const int conditions[11] = {[5] = 0x94, [6] = 0x95, [7] = 0x9c, [8] = 0x9e, [9] = 0x9f, [10] = 0x9d};
+
+    if (M == 0)
+    {
+        // RTN: SP = BP + 1, BP and PC from the frame, PC through the table
+        jitReg(1, 0x89, R13, R12);
+        jitReg(1, 0x81, 0, R12);
+        jitInt(1);
+        jitMem(0, 0x8b, R13, R12, -8);
+        jitMem(0, 0x8b, RAX, R12, -12);
+        jitJumpBack(jitDispatch);
+        jitDepth = 0;
+        jitClear();
+        return;
+    }
+
+    if (M == 11)
+    {
+        // ODD, the remainder keeps the sign of the operand like C's %
+        jitOperand(0x8b, RAX, 0);
+        jitReg(0, 0x89, RAX, RDX);
+        jitReg(0, 0xc1, 5, RDX);
+        jitByte(31);
+        jitReg(0, 0x03, RAX, RDX);
+        jitReg(0, 0x83, 4, RAX);
+        jitByte(1);
+        jitReg(0, 0x2b, RAX, RDX);
+        jitDepth++;
+        jitPush(RAX);
+        return;
+    }
+
+    if (M < 0 || M > 14)
+        return;
+
+    jitOperand(0x8b, RAX, 1);
+    switch (M)
+    {
+    case 1:
+        jitOperand(0x03, RAX, 0);
+        break;
+
+    case 2:
+        jitOperand(0x2b, RAX, 0);
+        break;
+
+    case 3:
+        jitOperand(0x0faf, RAX, 0);
+        break;
+
+    case 4: // cdq, idiv
+        jitByte(0x99);
+        jitOperand(0xf7, 7, 0);
+        break;
+
+    case 12: // shl eax, cl
+        jitOperand(0x8b, RCX, 0);
+        jitReg(0, 0xd3, 4, RAX);
+        break;
+
+    case 13:
+        // eax + ((eax >> 31) & ((1 << cl) - 1)) >> cl
+        jitOperand(0x8b, RCX, 0);
+        jitImm(R11, 1);
+        jitReg(0, 0xd3, 4, R11);
+        jitReg(0, 0xff, 1, R11);
+        jitReg(0, 0x89, RAX, RDX);
+        jitReg(0, 0xc1, 7, RDX);
+        jitByte(31);
+        jitReg(0, 0x23, RDX, R11);
+        jitReg(0, 0x03, RAX, RDX);
+        jitReg(0, 0xd3, 7, RAX);
+        break;
+
+    case 14:
+        jitOperand(0x23, RAX, 0);
+        break;
+
+    default: // cmp, setcc al, movzx eax, al
+        jitOperand(0x3b, RAX, 0);
+        jitReg(0, 0x0f00 | conditions[M], 0, RAX);
+        jitReg(0, 0x0fb6, RAX, RAX);
+        break;
+    }
+    jitDepth += 2;
+    jitPush(RAX);
+}
+
+// the stubs, shared by all the translated instructions
+void jitStubs()
+{
+    // jitStop (EOP) and jitExit (anything else) with PC in eax: save the
+    // registers and return 0 or 1
+    jitStop = jitSize;
+    jitImm(RDX, 0);
+    jitByte(0xeb);
+    jitByte(5);
+    jitExit = jitSize;
+    jitImm(RDX, 1);
+    jitGlobal(0x89, RAX, &PC);
+    jitGlobal(0x89, R12, &SP);
+    jitGlobal(0x89, R13, &BP);
+    jitReg(0, 0x89, RDX, RAX);
+    jitByte(0x41);
+    jitByte(0x5f);
+    jitByte(0x41);
+    jitByte(0x5e);
+    jitByte(0x41);
+    jitByte(0x5d);
+    jitByte(0x41);
+    jitByte(0x5c);
+    jitByte(0x5b);
+    jitByte(0xc3);
+
+    // entry: push rbx and r12 to r15 (which also aligns the stack for
+    // calls), load the registers and dispatch on PC
+    jitEntry = jitSize;
+    jitByte(0x53);
+    jitByte(0x41);
+    jitByte(0x54);
+    jitByte(0x41);
+    jitByte(0x55);
+    jitByte(0x41);
+    jitByte(0x56);
+    jitByte(0x41);
+    jitByte(0x57);
+    jitAddress(RBX, PAS);
+    jitGlobal(0x8b, R12, &SP);
+    jitGlobal(0x8b, R13, &BP);
+    jitGlobal(0x8b, RAX, &PC);
+
+    // jitDispatch: jmp [jitTable + rax * 8], PC in eax
+    jitDispatch = jitSize;
+    jitByte(0x3d);
+    jitInt(MAX_PAS_SIZE);
+    jitByte(0x0f);
+    jitByte(0x83);
+    jitInt(jitExit - (jitSize + 4));
+    jitAddress(RCX, jitTable);
+    jitByte(0xff);
+    jitByte(0x24);
+    jitByte(0xc1);
+}
+
+// translate the instructions loaded in PAS, 0 when they do not fit
+int jitTranslate()
+{
+    int count = codeLength / 3;
+    char entered[MAX_PAS_SIZE / 3 + 1] = {0};
+
+    if (jitCode == NULL)
+    {
+        jitCode = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jitCode == MAP_FAILED)
+        {
+            jitCode = NULL;
+            return 0;
+        }
+    }
+    else
+        mprotect(jitCode, JIT_CODE_SIZE, PROT_READ | PROT_WRITE);
+    jitSize = 0;
+    jitFixupCount = 0;
+    jitStubs();
+
+    // instructions control can reach other than by falling through start
+    // with r12 up to date and nothing cached
+    entered[0] = 1;
+    for (int i = 0; i < count; i++)
+    {
+        int op = PAS[3 * i], M = PAS[3 * i + 2];
+        if ((op == 5 || op == 7 || op == 8) && M >= 0 && M % 3 == 0 && M / 3 < count)
+            entered[M / 3] = 1;
+        if (op == 5)
+            entered[i + 1] = 1;
+    }
+
+    jitDepth = 0;
+    jitClear();
+    for (int i = 0; i < count; i++)
+    {
+        int op = PAS[3 * i], L = PAS[3 * i + 1], M = PAS[3 * i + 2], next = 3 * i + 3;
+        if (L > 64 || jitSize + 256 + 8 * L > JIT_CODE_SIZE)
+            return 0;
+
+        if (entered[i])
+            jitSettle();
+        jitLabel[i] = jitSize;
+
+        int reg;
+        switch (op)
+        {
+        case 1: // LIT
+            jitImm(RAX, M);
+            jitPush(RAX);
+            break;
+
+        case 2: // OPR
+            jitOperation(M);
+            break;
+
+        case 3: // LOD
+            reg = jitBase(L);
+            jitMem(0, 0x8b, RAX, reg, -M * 4);
+            jitPush(RAX);
+            break;
+
+        case 4: // STO, which may overwrite a cached cell
+            reg = jitCell(0);
+            if (reg < 0)
+            {
+                jitOperand(0x8b, RAX, 0);
+                reg = RAX;
+            }
+            jitMem(0, 0x89, reg, jitBase(L), -M * 4);
+            jitDepth++;
+            jitClear();
+            break;
+
+        case 5: // CAL
+            reg = jitBase(L);
+            jitSettle();
+            jitMem(0, 0x89, reg, R12, -4);
+            jitMem(0, 0x89, R13, R12, -8);
+            jitMem(0, 0xc7, 0, R12, -12);
+            jitInt(next);
+            jitReg(1, 0x89, R12, R13);
+            jitReg(1, 0x81, 0, R13);
+            jitInt(-1);
+            jitJump(0, M, count);
+            break;
+
+        case 6: // INC
+            jitGrow(M);
+            break;
+
+        case 7: // JMP
+            jitSettle();
+            jitJump(0, M, count);
+            break;
+
+        case 8: // JPC
+            reg = jitCell(0);
+            if (reg < 0)
+            {
+                jitOperand(0x8b, RAX, 0);
+                reg = RAX;
+            }
+            jitDepth++;
+            jitSettle();
+            jitReg(0, 0x85, reg, reg);
+            jitJump(1, M, count);
+            break;
+
+        case 9: // SYS, the calls clobber the pool
+            if (M == 1)
+            {
+                jitOperand(0x8b, RDI, 0);
+                jitDepth++;
+                jitCall(writeOutput);
+                jitClear();
+            }
+            else if (M == 2)
+            {
+                jitMem(1, 0x8d, RDI, R12, (jitDepth - 1) * 4);
+                jitCall(readInput);
+                jitGrow(1);
+                jitClear();
+            }
+            else if (M == 3)
+            {
+                jitSettle();
+                jitImm(RAX, next);
+                jitJumpBack(jitStop);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // running off the end of the code
+    jitSettle();
+    jitImm(RAX, 3 * count);
+    jitJumpBack(jitExit);
+
+    for (int i = 0; i < jitFixupCount; i++)
+    {
+        int at = jitFixupAt[i];
+        int offset = jitLabel[jitFixupTarget[i]] - (at + 4);
+        memcpy(jitCode + at, &offset, 4);
+    }
+    for (int pc = 0; pc < MAX_PAS_SIZE; pc++)
+        jitTable[pc] = jitCode + jitExit;
+    for (int i = 0; i < count; i++)
+        if (entered[i])
+            jitTable[3 * i] = jitCode + jitLabel[i];
+
+    mprotect(jitCode, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+    return 1;
+}
+
+// run the translated code from PC, finishing in the interpreter if it exits early
+void jitRun()
+{
+    int (*run)(void) = (int (*)(void))(jitCode + jitEntry);
+    if (run())
+        interpret(0);
+}
+
+#else
+
+int jitSize;
+
+int jitTranslate()
+{
+    return 0;
+}
+
+void jitRun()
+{
+}
+
+#endif
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a loop nest calling a procedure on every inner iteration, for --bench
+int benchLoop[] = {
+    7, 0, 21,        // 0   JMP main
+    6, 0, 3,         // 3   INC            procedure: s := s + j
+    3, 1, 5,         // 6   LOD 1 s
+    3, 1, 4,         // 9   LOD 1 j
+    2, 0, 1,         // 12  ADD
+    4, 1, 5,         // 15  STO 1 s
+    2, 0, 0,         // 18  RTN
+    6, 0, 6,         // 21  INC            main: i := 0
+    1, 0, 0,         // 24  LIT 0
+    4, 0, 3,         // 27  STO i
+    3, 0, 3,         // 30  LOD i          while i < outer
+    1, 0, 0,         // 33  LIT outer
+    2, 0, 7,         // 36  LSS
+    8, 0, 117,       // 39  JPC
+    1, 0, 0,         // 42  LIT 0          j := 0
+    4, 0, 4,         // 45  STO j
+    3, 0, 4,         // 48  LOD j          while j < 1000
+    1, 0, 1000,      // 51  LIT 1000
+    2, 0, 7,         // 54  LSS
+    8, 0, 102,       // 57  JPC
+    5, 0, 3,         // 60  CAL procedure
+    3, 0, 5,         // 63  LOD s          s := (s + i * j) / 2
+    3, 0, 3,         // 66  LOD i
+    3, 0, 4,         // 69  LOD j
+    2, 0, 3,         // 72  MUL
+    2, 0, 1,         // 75  ADD
+    1, 0, 2,         // 78  LIT 2
+    2, 0, 4,         // 81  DIV
+    4, 0, 5,         // 84  STO s
+    3, 0, 4,         // 87  LOD j          j := j + 1
+    1, 0, 1,         // 90  LIT 1
+    2, 0, 1,         // 93  ADD
+    4, 0, 4,         // 96  STO j
+    7, 0, 48,        // 99  JMP
+    3, 0, 3,         // 102 LOD i          i := i + 1
+    1, 0, 1,         // 105 LIT 1
+    2, 0, 1,         // 108 ADD
+    4, 0, 3,         // 111 STO i
+    7, 0, 30,        // 114 JMP
+    3, 0, 5,         // 117 LOD s          write s
+    9, 0, 1,         // 120 SOU
+    9, 0, 3};        // 123 EOP
+
+void benchEmit(int op, int L, int M)
+{
+    PAS[codeLength++] = op;
+    PAS[codeLength++] = L;
+    PAS[codeLength++] = M;
+}
+
+// procedures nested depth levels deep, each declaring a variable, called from
+// main calls times; the innermost one runs a loop of 100 adding the variable
+// of every level into one of main's, for --bench
+void buildNested(int depth, int calls)
+{
+    int entry[16], loop, exit;
+    memset(PAS, 0, sizeof(PAS));
+    codeLength = 0;
+    benchEmit(7, 0, 0); // JMP main
+    for (int k = depth; k >= 1; k--)
+    {
+        entry[k] = codeLength;
+        benchEmit(6, 0, k < depth ? 4 : 5); // INC
+        benchEmit(1, 0, k);                 // v := k
+        benchEmit(4, 0, 3);
+        if (k < depth)
+        {
+            benchEmit(5, 0, entry[k + 1]); // CAL the next level
+            benchEmit(2, 0, 0);
+            continue;
+        }
+
+        benchEmit(1, 0, 0); // j := 0
+        benchEmit(4, 0, 4);
+        loop = codeLength;
+        benchEmit(3, 0, 4); // while j < 100
+        benchEmit(1, 0, 100);
+        benchEmit(2, 0, 7);
+        exit = codeLength;
+        benchEmit(8, 0, 0);
+        benchEmit(3, depth, 3); // s := s + v1 + ... + j
+        for (int l = 1; l <= depth; l++)
+        {
+            benchEmit(3, depth - l, 3);
+            benchEmit(2, 0, 1);
+        }
+        benchEmit(3, 0, 4);
+        benchEmit(2, 0, 1);
+        benchEmit(4, depth, 3);
+        benchEmit(3, 0, 4); // j := j + 1
+        benchEmit(1, 0, 1);
+        benchEmit(2, 0, 1);
+        benchEmit(4, 0, 4);
+        benchEmit(7, 0, loop);
+        PAS[exit + 2] = codeLength;
+        benchEmit(2, 0, 0);
+    }
+
+    PAS[2] = codeLength;
+    benchEmit(6, 0, 5); // main: i := 0
+    benchEmit(1, 0, 0);
+    benchEmit(4, 0, 4);
+    loop = codeLength;
+    benchEmit(3, 0, 4); // while i < calls
+    benchEmit(1, 0, calls);
+    benchEmit(2, 0, 7);
+    exit = codeLength;
+    benchEmit(8, 0, 0);
+    benchEmit(5, 0, entry[1]);
+    benchEmit(3, 0, 4); // i := i + 1
+    benchEmit(1, 0, 1);
+    benchEmit(2, 0, 1);
+    benchEmit(4, 0, 4);
+    benchEmit(7, 0, loop);
+    PAS[exit + 2] = codeLength;
+    benchEmit(3, 0, 3); // write s
+    benchEmit(9, 0, 1);
+    benchEmit(9, 0, 3);
+}
+
+// engines for --engine and --bench
+enum
+{
+    ENGINE_SWITCH,
+    ENGINE_THREADED,
+    ENGINE_DISPLAY,
+    ENGINE_REG,
+    ENGINE_JIT
+};
+
+const char *engineNames[] = {"switch", "threaded", "display", "reg", "jit"};
+
+// best of five runs of an engine from a fresh stack, in seconds
+double timeRun(int engine, long *output)
+{
+    double best = 1e9;
+    int code[MAX_PAS_SIZE];
+    memcpy(code, PAS, codeLength * sizeof(int));
+    for (int run = 0; run < 5; run++)
+    {
+        memset(PAS, 0, sizeof(PAS));
+        memcpy(PAS, code, codeLength * sizeof(int));
+        resetRegisters();
+        executed = 0;
+        regExecuted = 0;
+        quietOutput = 0;
+        double start = now();
+        if (engine == ENGINE_JIT)
+            jitRun();
+        else if (engine == ENGINE_THREADED || engine == ENGINE_DISPLAY)
+            threaded(0);
+        else if (engine == ENGINE_REG)
+            regRun();
+        else
+            interpret(0);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    *output = quietOutput;
+    return best;
+}
+
+// the switch loop against the threaded engine and translated code on the
+// program in PAS
+void benchProgram(const char *name)
+{
+    long expected, output;
+    double interpreted = timeRun(ENGINE_SWITCH, &expected);
+    long count = executed;
+    printf("\n%s: %ld instructions executed\n", name, count);
+    printf("  switch       %.3f ms  %.1f Minstructions/s\n", interpreted * 1e3, count / 1e6 / interpreted);
+
+    for (int engine = ENGINE_THREADED; engine <= ENGINE_DISPLAY; engine++)
+    {
+        double start = now();
+        if (decodeProgram(engine == ENGINE_DISPLAY) != (engine == ENGINE_DISPLAY))
+        {
+            printf("  display      levels not inferred\n");
+            continue;
+        }
+        double decoding = now() - start;
+        double decodedTime = timeRun(engine, &output);
+        printf("  %-12s %.3f ms  %.1f Minstructions/s  %.2fx faster (decoded in %.3f ms)\n", engineNames[engine],
+               decodedTime * 1e3, count / 1e6 / decodedTime, interpreted / decodedTime, decoding * 1e3);
+        printf("  %s\n", output == expected && executed == count ? "same output" : "DIFFERENT output");
+    }
+
+    double start = now();
+    if (regTranslate())
+    {
+        double translation = now() - start;
+        double registers = timeRun(ENGINE_REG, &output);
+        printf("  reg          %.3f ms  %.1f Minstructions/s  %.2fx faster (translated in %.3f ms)\n", registers * 1e3,
+               count / 1e6 / registers, interpreted / registers, translation * 1e3);
+        printf("  %s, %ld register instructions (%.0f%% of the stack machine's)\n",
+               output == expected ? "same output" : "DIFFERENT output", regExecuted, 100.0 * regExecuted / count);
+    }
+    else
+        printf("  reg          does not qualify\n");
+
+    start = now();
+    if (!jitTranslate())
+    {
+        printf("  jit          not available\n");
+        return;
+    }
+    double translation = now() - start;
+    double translated = timeRun(ENGINE_JIT, &output);
+    printf("  jit          %.3f ms  %.1f Minstructions/s  %.1fx faster (translated in %.3f ms, %d bytes)\n",
+           translated * 1e3, count / 1e6 / translated, interpreted / translated, translation * 1e3, jitSize);
+    printf("  %s\n", output == expected ? "same output" : "DIFFERENT output");
+}
+
+// the switch loop and the threaded engine on the program in PAS with each
+// kind of trace, written to /dev/null
+void benchTrace(const char *name)
+{
+    const char *kinds[] = {"none", "ops", "full", "binary"};
+    FILE *null = fopen("/dev/null", "w");
+    if (null == NULL)
+        return;
+    int code[MAX_PAS_SIZE];
+    memcpy(code, PAS, codeLength * sizeof(int));
+    decodeProgram(0);
+
+    printf("\n%s, traced to /dev/null\n", name);
+    for (int kind = 0; kind < 4; kind++)
+        for (int engine = ENGINE_SWITCH; engine <= ENGINE_THREADED; engine++)
+        {
+            memset(PAS, 0, sizeof(PAS));
+            memcpy(PAS, code, codeLength * sizeof(int));
+            resetRegisters();
+            executed = 0;
+            traceOut = null;
+            traceMode = kind == 1 ? TRACE_OPS : TRACE_FULL;
+            if (kind == 3)
+                startTrace(null);
+            double start = now();
+            if (engine == ENGINE_THREADED)
+                threaded(kind != 0);
+            else
+                interpret(kind != 0);
+            double elapsed = now() - start;
+            printf("  %-8s %-8s %.3f ms  %.1f Minstructions/s\n", kinds[kind], engineNames[engine], elapsed * 1e3,
+                   executed / 1e6 / elapsed);
+            traceFile = NULL;
+        }
+    traceOut = stdout;
+    traceMode = TRACE_FULL;
+    fclose(null);
+}
+
+void runBenchmark(int fileCount, char **files)
+{
+    quiet = 1;
+    printf("VM benchmark, output discarded and reads taking 0\n");
+    for (int i = 0; i < fileCount; i++)
+    {
+        memset(PAS, 0, sizeof(PAS));
+        loadProgram(files[i]);
+        benchProgram(files[i]);
+    }
+
+    int outer[] = {10, 1000};
+    for (int i = 0; i < 2; i++)
+    {
+        char name[64];
+        memset(PAS, 0, sizeof(PAS));
+        memcpy(PAS, benchLoop, sizeof(benchLoop));
+        PAS[35] = outer[i];
+        codeLength = sizeof(benchLoop) / sizeof(int);
+        sprintf(name, "Loop nest, %d x 1000 calls", outer[i]);
+        benchProgram(name);
+    }
+
+    int depths[] = {6, 10};
+    for (int i = 0; i < 2; i++)
+    {
+        char name[64];
+        buildNested(depths[i], 1000);
+        sprintf(name, "Procedures nested %d deep, 1000 x 100 iterations", depths[i]);
+        benchProgram(name);
+    }
+
+    memset(PAS, 0, sizeof(PAS));
+    memcpy(PAS, benchLoop, sizeof(benchLoop));
+    PAS[35] = 10;
+    codeLength = sizeof(benchLoop) / sizeof(int);
+    benchTrace("Loop nest, 10 x 1000 calls");
+}
+
+int main(int argc, char *argv[])
+{
+    // --stats: report how many instructions were executed
+    // --engine=switch|threaded|display|reg|jit: how to run the program, --jit for jit
+    // --trace=none|ops|full: what to print after every instruction
+    // --trace-file=<file>: write the trace there in binary instead
+    int stats = 0, engine = ENGINE_SWITCH;
+    const char *traceName = NULL, *program = argv[0];
+    traceOut = stdout;
+    while (argc > 2 && strncmp(argv[1], "--", 2) == 0 && strcmp(argv[1], "--bench") != 0 &&
+           strcmp(argv[1], "--print-trace") != 0)
+    {
+        if (strcmp(argv[1], "--stats") == 0)
+            stats = 1;
+        else if (strcmp(argv[1], "--jit") == 0)
+            engine = ENGINE_JIT;
+        else if (strncmp(argv[1], "--engine=", 9) == 0)
+        {
+            engine = -1;
+            for (int i = 0; i < 5; i++)
+                if (strcmp(argv[1] + 9, engineNames[i]) == 0)
+                    engine = i;
+            if (engine < 0)
+            {
+                printf("%s: unknown engine %s\n", program, argv[1] + 9);
+                return 1;
+            }
+        }
+        else if (strncmp(argv[1], "--trace=", 8) == 0)
+        {
+            const char *modes[] = {"none", "ops", "full"};
+            traceMode = -1;
+            for (int i = 0; i < 3; i++)
+                if (strcmp(argv[1] + 8, modes[i]) == 0)
+                    traceMode = i;
+            if (traceMode < 0)
+            {
+                printf("%s: unknown trace %s\n", program, argv[1] + 8);
+                return 1;
+            }
+        }
+        else if (strncmp(argv[1], "--trace-file=", 13) == 0)
+            traceName = argv[1] + 13;
+        else
+            break;
+        argv++;
+        argc--;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        runBenchmark(argc - 2, argv + 2);
+        return 0;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--print-trace") == 0)
+        return printTrace(argv[2]);
+
+    if (argc != 2)
+    {
+        printf("Usage: %s [--stats] [--engine=switch|threaded|display|reg|jit] [--jit] [--trace=none|ops|full]\n", program);
+        printf("       %*s [--trace-file=<trace file>] <input file>\n", (int)strlen(program), "");
+        printf("       %s --print-trace <trace file>\n", program);
+        printf("       %s --bench [code file...]\n", program);
+        return 1;
+    }
+
+    // load program into PAS
+    loadProgram(argv[1]);
+
+    // initialize registers
+    resetRegisters();
+
+    if (engine == ENGINE_JIT)
+    {
+        if (jitTranslate())
+        {
+            jitRun();
+            if (stats)
+                printf("\nTranslated instructions: %d into %d bytes\n", codeLength / 3, jitSize);
+            return 0;
+        }
+        fprintf(stderr, "%s: --jit is not available here, interpreting\n", program);
+        interpret(0);
+        return 0;
+    }
+
+    if (engine == ENGINE_REG)
+    {
+        if (regTranslate())
+        {
+            regRun();
+            if (stats)
+                printf("\nExecuted register instructions: %ld (%d translated)\n", regExecuted, regCount);
+            return 0;
+        }
+        fprintf(stderr, "%s: the program does not qualify for --engine=reg, interpreting\n", program);
+        interpret(0);
+        if (stats)
+            printf("\nExecuted instructions: %ld\n", executed);
+        return 0;
+    }
+
+    int trace = traceMode != TRACE_NONE;
+    if (traceName != NULL)
+    {
+        FILE *fp = fopen(traceName, "wb");
+        if (fp == NULL)
+        {
+            perror("Error opening trace file\n");
+            return 1;
+        }
+        setvbuf(fp, NULL, _IOFBF, 1 << 20);
+        startTrace(fp);
+        trace = 1;
+    }
+    else if (trace)
+        // print header and initial values
+        printHeader();
+
+    if (engine == ENGINE_DISPLAY && !decodeProgram(1))
+        fprintf(stderr, "%s: levels could not be inferred, running without the display\n", program);
+    else if (engine == ENGINE_THREADED)
+        decodeProgram(0);
+    if (engine == ENGINE_THREADED || engine == ENGINE_DISPLAY)
+        threaded(trace);
+    else
+        interpret(trace);
+
+    if (traceFile != NULL)
+        fclose(traceFile);
+    if (stats)
+        printf("\nExecuted instructions: %ld\n", executed);
+    return 0;
+}